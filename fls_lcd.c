@@ -8,11 +8,92 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
+#include <linux/of.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/bitops.h>
+#include <linux/pm_runtime.h>
+#include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/fault-inject.h>
+#include <linux/notifier.h>
+#include <linux/console.h>
+#include <linux/spinlock.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/hrtimer.h>
+#include <linux/kernel_stat.h>
+#include <linux/thermal.h>
+#include <linux/netdevice.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <net/net_namespace.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+#include <linux/panic_notifier.h>
+#endif
 #include <asm/io.h>
 #include <asm/uaccess.h>
 
 #define MODULE_NAME "FLS front panel LCD"
 
+// keep building on current kernels too (the KUnit suite runs on x86 boxes)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+#define ioremap_nocache ioremap
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define lcd_class_create(name) class_create(name)
+#else
+#define lcd_class_create(name) class_create(THIS_MODULE, name)
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+#define get_random_int get_random_u32
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+#define init_kthread_worker kthread_init_worker
+#define init_kthread_work kthread_init_work
+#define queue_kthread_work kthread_queue_work
+#define flush_kthread_work kthread_flush_work
+#define flush_kthread_worker kthread_flush_worker
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#define lcd_cputime_ns(t) (t)
+#else
+#define lcd_cputime_ns(t) cputime_to_nsecs(t)
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+#define lcd_hrtimer_setup(timer, fn, clock, mode) hrtimer_setup(timer, fn, clock, mode)
+#else
+#define lcd_hrtimer_setup(timer, fn, clock, mode) do { hrtimer_init(timer, clock, mode); (timer)->function = fn; } while (0)
+#endif
+// a clock that never waits on the timekeeper, which another cpu may have
+// been stopped halfway through updating by the time we panic
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0)
+#define lcd_fast_ns() ktime_get_mono_fast_ns()
+#else
+#define lcd_fast_ns() sched_clock()
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+typedef int lcd_temp_t;
+#else
+typedef unsigned long lcd_temp_t;
+#endif
+
+// bus faults for exercising the recovery paths, set the rates through the
+// debugfs fls_lcd/fail_* directories (see fault-injection.txt)
+#ifdef CONFIG_FAULT_INJECTION
+static DECLARE_FAULT_ATTR(fail_lcd_drop);	// a nibble never gets strobed in
+static DECLARE_FAULT_ATTR(fail_lcd_dup);	// a nibble gets strobed in twice
+static DECLARE_FAULT_ATTR(fail_lcd_flip);	// a data line is wrong as a nibble is written
+static DECLARE_FAULT_ATTR(fail_lcd_busy);	// the busy flag sticks
+#define lcd_fault(name) should_fail(&fail_lcd_##name, 1)
+#else
+#define lcd_fault(name) (false)
+#endif
+
 #ifdef MODULE
 #define DEVNODE
 #define LCD_SPLASH_MSG ""
@@ -30,27 +111,129 @@ static int hw_reset = LCD_HW_RESET;
 module_param(hw_reset, int, S_IRUGO);
 MODULE_PARM_DESC(hw_reset, "reset the lcd on init, or assume it is already configured");
 
+static int attach = 1;
+module_param(attach, int, S_IRUGO);
+MODULE_PARM_DESC(attach, "when not doing a hw_reset read back what is on the lcd (and where the cursor is) instead of just homing");
+
 static char *splash_msg = LCD_SPLASH_MSG;
 module_param(splash_msg, charp, S_IRUGO);
 MODULE_PARM_DESC(splash_msg, "The message to display on the LCD when the module loads");
 
+static int sim = 0;
+module_param(sim, int, S_IRUGO);
+MODULE_PARM_DESC(sim, "drive a simulated lcd instead of the board (1 = instant, 2 = with datasheet execution times)");
+
+static int busy_model = 0;
+module_param(busy_model, int, S_IRUGO);
+MODULE_PARM_DESC(busy_model, "predict when the lcd is ready from a per-command execution time model and only poll the busy flag when unsure");
+
+static char *timing = NULL;
+module_param(timing, charp, S_IRUGO);
+MODULE_PARM_DESC(timing, "bus timing profile for the board (ts8500, fls), defaults to the device tree or ts8500");
+
+static char *geometry = NULL;
+module_param(geometry, charp, S_IRUGO);
+MODULE_PARM_DESC(geometry, "panel columns x lines (16x4, 16x2, 20x2, 20x4, 40x2, 40x4 with two e lines), defaults to the device tree or 16x4");
+
+static char *rom = NULL;
+module_param(rom, charp, S_IRUGO);
+MODULE_PARM_DESC(rom, "character rom of the panel (a00 japanese, a02 european), defaults to the device tree or a00");
+
+static int utf8 = 1;
+module_param(utf8, int, S_IRUGO);
+MODULE_PARM_DESC(utf8, "write utf-8 text as the rom's (or a loaded glyph's) chars, 0 to send bytes as they are");
+
+static int calibrate = 0;
+module_param(calibrate, int, S_IRUGO);
+MODULE_PARM_DESC(calibrate, "shorten the bus timings at init for as long as read-back still works (needs hw_reset)");
+
+static int scrub = 0;
+module_param(scrub, int, S_IRUGO);
+MODULE_PARM_DESC(scrub, "ms between background checks of a few cells against the shadow copy (0 to verify every char as it is written instead)");
+
+static int autosuspend = 0;
+module_param(autosuspend, int, S_IRUGO);
+MODULE_PARM_DESC(autosuspend, "seconds without writes before the lcd is suspended (0 to never, see also power/autosuspend_delay_ms)");
+
+static int power_down = 0;
+module_param(power_down, int, S_IRUGO);
+MODULE_PARM_DESC(power_down, "cut the lcd power when suspended instead of just turning the display off");
+
+static int peephole = 1;
+module_param(peephole, int, S_IRUGO);
+MODULE_PARM_DESC(peephole, "drop commands that would leave the lcd as it is and merge cursor/blink changes (0 to send everything)");
+
+static int frame = 0;
+module_param(frame, int, S_IRUGO);
+MODULE_PARM_DESC(frame, "buffer each write and send the cheapest commands for what changed when it ends (pair with scrub, chars are not read back)");
+
+static int panic_msg = 1;
+module_param(panic_msg, int, S_IRUGO);
+MODULE_PARM_DESC(panic_msg, "show the panic message on the lcd when the kernel panics");
+
+static int con_lines = 0;
+module_param(con_lines, int, S_IRUGO);
+MODULE_PARM_DESC(con_lines, "show kernel messages on this many of the bottom lines of the lcd (0 for no console)");
+
+static int con_level = 6;
+module_param(con_level, int, S_IRUGO);
+MODULE_PARM_DESC(con_level, "show kernel messages of this loglevel or more urgent on the console (0-7, 6 for info)");
+
+static int con_rate = 250;
+module_param(con_rate, int, S_IRUGO);
+MODULE_PARM_DESC(con_rate, "ms between console redraws, messages in between only show the latest");
+
+static int engine = 1;
+module_param(engine, int, S_IRUGO);
+MODULE_PARM_DESC(engine, "do all bus work on one lcd-engine thread rather than in whoever asked for it");
+
+static int engine_policy = SCHED_NORMAL;
+module_param(engine_policy, int, S_IRUGO);
+MODULE_PARM_DESC(engine_policy, "scheduling policy of the engine thread (0 normal, 1 fifo, 2 rr)");
+
+static int engine_prio = 0;
+module_param(engine_prio, int, S_IRUGO);
+MODULE_PARM_DESC(engine_prio, "engine thread rt priority (fifo and rr) or nice value (normal)");
+
+static char *engine_cpus = NULL;
+module_param(engine_cpus, charp, S_IRUGO);
+MODULE_PARM_DESC(engine_cpus, "cpu list the engine thread may run on, eg 0 for a housekeeping core (default any)");
+
+static int trigger_rate = 1000;
+module_param(trigger_rate, int, S_IRUGO);
+MODULE_PARM_DESC(trigger_rate, "ms between refreshes of fields bound to a trigger");
+
+static int write_slice = 64;
+module_param(write_slice, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(write_slice, "bytes of a write sent at a time while other writers are waiting for the bus (0 for whole writes)");
+
+static int capture = 1;
+module_param(capture, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(capture, "record every dio call in a ring for debugfs fls_lcd/capture (cheap, clear to freeze the ring)");
+
 // hw layout
 #define SYSCON_BASE (0x80004000)
 #define RS	(1 << 6)
 #define RW	(1 << 7)
 #define E	(1 << 8)
+#define E2	(1 << 10)	// second controller's e on 40x4 panels
 #define D4	(1 << 0)
 #define D5	(1 << 1)
 #define D6	(1 << 4)
 #define D7	(1 << 5)
 #define PWR	(1 << 9)
 
-// mapping for dram address to position on screen
-#define LINE_LENGTH (0x10)
-#define LINE1_START (0x00)
-#define LINE2_START (0x40)
-#define LINE3_START (0x10)
-#define LINE4_START (0x50)
+#include "fls_lcd_engine.h"
+#include "fls_lcd_ioctl.h"
+
+// where everything is on the panel we drive, built by lcd_init() from the
+// geometry param or device tree
+static struct lcd_map lcd_map;
+
+// the codes text is written as, built by lcd_init() from the rom param or
+// device tree and rebuilt as glyphs are loaded into cgram
+static struct lcd_charset lcd_charset;
+static uint8_t lcd_glyph_rows[LCD_GLYPHS][8];
 
 // timings from datasheet (plus tm to add a little margin so we are safe)
 #define Tpor0     (50) // ms delay
@@ -67,6 +250,46 @@ MODULE_PARM_DESC(splash_msg, "The message to display on the LCD when the module
 #define Td        (120)
 #define Tm        (50)
 
+// command execution times from datasheet (fosc = 270kHz) in ns, these only seed
+// the busy model which then refines them from what the lcd actually does
+#define Texec_home (1520000)
+#define Texec_data (43000)	// 37us + tadd
+#define Texec_addr (37000)
+#define Texec_ctrl (37000)
+#define Tpoll      (10)		// us between busy polls while the model is measuring
+#define Tpanic     (2000)	// most us the panic path waits for the busy flag
+
+struct lcd_timing {
+	const char *name;
+	int tsp1, tpw, tsp2, td, tc, tr, tf;	// ns, from the datasheet
+	int tm;					// ns of margin added to the above
+	int tcap;				// us for the data lines to settle
+};
+
+#define LCD_DATASHEET_TIMING \
+	.tsp1 = Tsp1, .tpw = Tpw, .tsp2 = Tsp2, .td = Td, .tc = Tc, .tr = Tr, .tf = Tf, .tm = Tm
+
+static const struct lcd_timing lcd_timings[] = {
+	{
+		// even though u10 is powered off on the TS8500 it still adds a lot of
+		// capacitance to the d5 line, this takes 5us to die away so we wait
+		// for the data lines to settle (with plenty of extra margin)
+		.name = "ts8500",
+		LCD_DATASHEET_TIMING,
+		.tcap = 50,
+	},
+	{
+		// the real fls has no u10 so the datasheet timings are all we need
+		.name = "fls",
+		LCD_DATASHEET_TIMING,
+		.tcap = 0,
+	},
+	{
+		// the simulated lcd latches on the edges alone so needs no delays
+		.name = "sim",
+	},
+};
+
 struct dio_reg_t {
 	unsigned long paddr;
 	size_t size;
@@ -74,16 +297,94 @@ struct dio_reg_t {
 	void __iomem *vaddr;
 };
 
+// simulated HD44780 hanging off the dio pins (4 bit bus, 2 line dram
+// layout) so the driver can be tested and measured without the fls board
+struct lcd_sim {
+	unsigned int pins;	// output state as driven by dio_set()
+	bool timing;		// emulate command execution times (busy flag)
+	bool nibble_mode;	// 4 bit interface selected by function set
+	bool low_nibble;	// next e strobe transfers the low nibble
+	uint8_t latch;		// byte being transferred
+	uint8_t ddram[LCD_DRAM_SIZE];
+	uint8_t cgram[0x40];
+	uint8_t ac;
+	bool cgram_sel;		// ac points into cgram
+	uint8_t entry, control, function;
+	ktime_t busy_until;
+
+	// bus and command counters
+	unsigned long sets, gets;
+	unsigned long nibbles;
+	unsigned long cmds, data_writes, data_reads, status_reads;
+	unsigned long violations;	// accesses while still busy
+};
+
+static struct lcd_sim lcd_sim[LCD_CTRLS];
+
 static struct dio_t {
+	struct lcd_sim *sim[LCD_CTRLS];	// if set the registers below are not used
+	unsigned int e[LCD_CTRLS];	// each controller's e, the rest of the bus is shared
+	spinlock_t lock;	// the registers are shared read-modify-write
 	struct dio_reg_t dir;	
 	struct dio_reg_t in;	
 	struct dio_reg_t out;	
 } lcd_dio = {
+	.e = {E, E2},
+	.lock = __SPIN_LOCK_UNLOCKED(lcd_dio.lock),
 	.dir = {.paddr = SYSCON_BASE + 0x1e, .size = 2},
 	.in  = {.paddr = SYSCON_BASE + 0x26, .size = 2},
 	.out = {.paddr = SYSCON_BASE + 0x16, .size = 2},
 };
 
+// the last LCD_CAPTURE_SIZE dio calls, for working out what was on the pins
+// when the lcd misbehaves (read from debugfs and decode with lcd_decode)
+#define LCD_CAPTURE_SIZE    (4096)		// records, must be a power of 2
+#define LCD_CAPTURE_GET     (0x8000)		// marks a dio_get() record
+#define LCD_CAPTURE_MAGIC   (0x43534c46)	// "FLSC"
+#define LCD_CAPTURE_VERSION (1)
+
+struct lcd_capture_rec {
+	u32 ts;		// ns, low 32 bits of ktime
+	u16 a;		// set mask, or get mask | LCD_CAPTURE_GET
+	u16 b;		// clear mask, or the value read
+};
+
+// what debugfs fls_lcd/capture returns, followed by count records oldest first
+struct lcd_capture_hdr {
+	u32 magic;
+	u16 version;
+	u16 rec_size;
+	u32 count;
+	u32 lost;	// older records overwritten since the ring was cleared
+	u64 tn;		// ns, full timestamp of the newest record
+};
+
+// records are claimed with an atomic increment so writers never wait
+static struct lcd_capture {
+	atomic_t head;
+	u64 tn;
+	struct lcd_capture_rec rec[LCD_CAPTURE_SIZE];
+} lcd_capture;
+
+static struct dentry *lcd_debugfs;
+
+static void lcd_capture_rec(u16 a, u16 b)
+{
+	struct lcd_capture_rec *r;
+	u64 ts;
+
+	if (!capture)
+		return;
+
+	// this runs on the panic path too so no ktime_get()
+	ts = lcd_fast_ns();
+	r = &lcd_capture.rec[(atomic_inc_return(&lcd_capture.head) - 1) & (LCD_CAPTURE_SIZE - 1)];
+	r->ts = (u32)ts;
+	r->a = a;
+	r->b = b;
+	lcd_capture.tn = ts;
+}
+
 enum lcd_busy_state {
 	lcd_idle = 0x00,
 	lcd_busy = 0x80,
@@ -129,38 +430,393 @@ enum lcd_sh {
 	lcd_sh_on = 0x01,
 };
 
-enum write_state {
-	WRITE_STATE_NORMAL,
-	WRITE_STATE_ESCAPE1
+enum lcd_cmd_class {
+	LCD_CMD_HOME,		// clear and home
+	LCD_CMD_DATA,		// data read/write
+	LCD_CMD_ADDR,		// set cgram/dram address
+	LCD_CMD_CTRL,		// everything else (display control, entry mode, etc)
+	LCD_CMD_CLASSES,
+	LCD_CMD_NONE = LCD_CMD_CLASSES,
+};
+
+// a prediction is only trusted (ie we skip polling) once this many commands
+// have been timed by polling, and even then every LCD_MODEL_VERIFY'th command
+// is still polled so we notice if the lcd gets slower (temperature, supply etc)
+#define LCD_MODEL_CONFIDENT (8)
+#define LCD_MODEL_VERIFY    (32)
+
+struct lcd_cmd_model {
+	unsigned int est;	// predicted execution time (ns)
+	unsigned int hits;	// commands timed so far
+	unsigned int worst;	// slowest of those (ns)
+	unsigned long issued;
+	unsigned long polled;
+	unsigned long predicted;
+};
+
+// what we know of the controller the bus isn't talking to on a panel with
+// two, lcd_select() swaps it with the fields of the same name in lcd_t
+struct lcd_ctrl {
+	int ac;
+	int control;
+	int entry;
+	bool unshifted;
+	enum lcd_cmd_class last_cmd;
+	ktime_t last_issue;
+	bool ready;
 };
 
 static atomic_t corrupt = ATOMIC_INIT(0);
 static atomic_t busy = ATOMIC_INIT(0);
 
+// the scrubber checks this many cells per pass, and only once the bus
+// has been left alone by writers for LCD_SCRUB_IDLE
+#define LCD_SCRUB_CELLS (4)
+#define LCD_SCRUB_IDLE  (HZ / 10)
+
 static struct lcd_t {
+	struct mutex lock;	// serialises bus access
+	struct kthread_worker worker;	// the engine thread all bus work runs on
+	struct task_struct *engine;
+	struct device *dev;	// for runtime pm (NULL when there is no device node)
 	struct dio_t *dio;
+	const struct lcd_map *map;
+	unsigned int e;		// e line(s) the bus strobes
+	int sel;		// controller the bus talks to
+	struct lcd_ctrl other;	// and the one it doesn't
 	int pos;
 	enum write_state wstate;
+	struct lcd_charset *charset;	// NULL to write bytes as they are
+	struct lcd_utf8 utf8;
 	enum lcd_display display_state;
 	enum lcd_cursor cursor_state;
 	enum lcd_blink blink_state;
 	bool am;
+	struct lcd_timing timing;
+
+	// what the (selected) lcd is known to be set to (-1 where we don't
+	// know), so the command queue can drop commands that would change nothing
+	int ac;
+	int control;
+	int entry;
+	bool unshifted;		// no display shift since the last clear/home
+	bool control_pending;	// cursor/blink changed but not sent yet
+	int want;		// dram address to set before the next data access (-1 none)
+	struct lcd_queue_stats {
+		unsigned long sent;
+		unsigned long dropped;	// would not have changed anything
+		unsigned long merged;	// cursor/blink changes sent together
+		unsigned long homes;	// homes sent as a quicker address set
+		unsigned long moves;	// address sets never sent as nothing was written there
+	} queue;
+
+	// busy model state
+	struct lcd_cmd_model model[LCD_CMD_CLASSES];
+	enum lcd_cmd_class last_cmd;
+	ktime_t last_issue;
+	bool ready;
+
+	// what we intended to put in dram (valid only where we know it)
+	char shadow[LCD_ADDRS];
+	DECLARE_BITMAP(shadow_valid, LCD_ADDRS);
+
+	// frame mode, while deferred the engine only updates frame and the
+	// flush planner works out how to get the lcd there
+	bool deferred;
+	char frame[LCD_ADDRS];
+	DECLARE_BITMAP(frame_dirty, LCD_ADDRS);
+	int naive_ac;
+	unsigned long naive_ns;		// what sending it as written would cost
+	struct lcd_plan_stats {
+		unsigned long flushes;
+		unsigned long clears;
+		unsigned long data;
+		unsigned long fills;	// unchanged cells rewritten to save an address set
+		unsigned long addrs;
+		u64 planned_ns;
+		u64 naive_ns;
+	} plan;
+
+	// scrubber state
+	unsigned long last_write;
+	int scrub_cell;
+	unsigned long scrub_checked;
+	unsigned long scrub_repairs;
+	unsigned long scrub_resyncs;
+
+	// power management state
+	bool suspended;
+	bool powered;
+	unsigned long resumes;
+	s64 resume_last;	// us
+	s64 resume_max;		// us
+
+	unsigned long cmds;		// commands and chars sent so far
+
+	// recovery accounting, from finding the lcd wrong to having put it right
+	unsigned long strobes;		// e strobes so far
+	int recovery_depth;		// recoveries begun and not yet ended
+	ktime_t recovery_start;
+	unsigned long recovery_strobes;
+	struct lcd_recovery {
+		unsigned long events;
+		unsigned long failed;	// gave up with the lcd still wrong
+		unsigned long busy_timeouts;
+		unsigned long strobes;	// spent recovering
+		u64 ns;			// spent recovering
+		u64 max_ns;
+	} recovery;
 } lcd = {
+	.lock = __MUTEX_INITIALIZER(lcd.lock),
 	.dio = &lcd_dio,
+	.map = &lcd_map,
 	.pos = 0,
 	.wstate = WRITE_STATE_NORMAL,
 	.am = true,
+	.timing = {.name = "ts8500", LCD_DATASHEET_TIMING, .tcap = 50},
+	.e = E,
+	.other = {.ac = -1, .control = -1, .entry = -1, .last_cmd = LCD_CMD_NONE},
+	.ac = -1,
+	.control = -1,
+	.entry = -1,
+	.want = -1,
+	.last_cmd = LCD_CMD_NONE,
+	.powered = true,
 };
 
+// power on reset state of the simulated lcd (8 bit interface, cleared)
+static void lcd_sim_reset(struct lcd_sim *sim)
+{
+	bool timing = sim->timing;
+
+	memset(sim, 0, sizeof(*sim));
+	memset(sim->ddram, ' ', sizeof(sim->ddram));
+	sim->timing = timing;
+	sim->entry = 0x06;
+	sim->pins = PWR;
+}
+
+static void lcd_sim_clear_stats(struct lcd_sim *sim)
+{
+	sim->sets = sim->gets = sim->nibbles = 0;
+	sim->cmds = sim->data_writes = sim->data_reads = sim->status_reads = 0;
+	sim->violations = 0;
+}
+
+static bool lcd_sim_busy(struct lcd_sim *sim)
+{
+	return sim->timing && ktime_to_ns(ktime_sub(sim->busy_until, ktime_get())) > 0;
+}
+
+static void lcd_sim_advance(struct lcd_sim *sim)
+{
+	bool inc = sim->entry & lcd_id_right;
+
+	if (sim->cgram_sel) {
+		sim->ac = (sim->ac + (inc ? 1 : -1)) & 0x3f;
+	} else if (inc) {
+		// dram is two 40 byte lines at 0x00 and 0x40
+		sim->ac = sim->ac == 0x27 ? 0x40 : sim->ac == 0x67 ? 0x00 : sim->ac + 1;
+	} else {
+		sim->ac = sim->ac == 0x40 ? 0x27 : sim->ac == 0x00 ? 0x67 : sim->ac - 1;
+	}
+}
+
+static void lcd_sim_exec(struct lcd_sim *sim, bool rs, uint8_t db)
+{
+	s64 t = Texec_ctrl;
+
+	if (lcd_sim_busy(sim))
+		sim->violations++;
+
+	if (rs) {
+		sim->data_writes++;
+		if (sim->cgram_sel)
+			sim->cgram[sim->ac] = db;
+		else
+			sim->ddram[sim->ac & 0x7f] = db;
+		lcd_sim_advance(sim);
+		t = Texec_data;
+	} else {
+		sim->cmds++;
+		if (db & 0x80) {
+			sim->ac = db & 0x7f;
+			sim->cgram_sel = false;
+			t = Texec_addr;
+		} else if (db & 0x40) {
+			sim->ac = db & 0x3f;
+			sim->cgram_sel = true;
+			t = Texec_addr;
+		} else if (db & 0x20) {
+			sim->function = db;
+			sim->nibble_mode = !(db & lcd_8bit);
+		} else if (db & 0x10) {
+			// cursor shift (display shift is not simulated)
+			if (!(db & 0x08)) {
+				if (db & 0x04)
+					lcd_sim_advance(sim);
+				else
+					sim->ac = (sim->ac - 1) & 0x7f;
+			}
+		} else if (db & 0x08) {
+			sim->control = db;
+		} else if (db & 0x04) {
+			sim->entry = db;
+		} else if (db & 0x02) {
+			sim->ac = 0;
+			sim->cgram_sel = false;
+			t = Texec_home;
+		} else if (db & 0x01) {
+			memset(sim->ddram, ' ', sizeof(sim->ddram));
+			sim->ac = 0;
+			sim->cgram_sel = false;
+			sim->entry |= lcd_id_right;
+			t = Texec_home;
+		}
+	}
+
+	sim->busy_until = ktime_add_ns(ktime_get(), t);
+}
+
+static uint8_t lcd_sim_nibble(unsigned int pins)
+{
+	return (pins & D4 ? 0x1 : 0) | (pins & D5 ? 0x2 : 0) | (pins & D6 ? 0x4 : 0) | (pins & D7 ? 0x8 : 0);
+}
+
+static void lcd_sim_e_rise(struct lcd_sim *sim)
+{
+	// reads present the whole byte from the first strobe
+	if (!(sim->pins & RW) || sim->low_nibble)
+		return;
+
+	if (sim->pins & RS) {
+		if (lcd_sim_busy(sim))
+			sim->violations++;
+		sim->latch = sim->cgram_sel ? sim->cgram[sim->ac] : sim->ddram[sim->ac & 0x7f];
+	} else {
+		sim->latch = (lcd_sim_busy(sim) ? lcd_busy : lcd_idle) | (sim->ac & 0x7f);
+	}
+}
+
+static void lcd_sim_e_fall(struct lcd_sim *sim)
+{
+	bool rs = sim->pins & RS;
+
+	sim->nibbles++;
+
+	if (sim->pins & RW) {
+		if (sim->low_nibble || !sim->nibble_mode) {
+			if (rs) {
+				sim->data_reads++;
+				lcd_sim_advance(sim);
+				sim->busy_until = ktime_add_ns(ktime_get(), Texec_data);
+			} else {
+				sim->status_reads++;
+			}
+		}
+		if (sim->nibble_mode)
+			sim->low_nibble = !sim->low_nibble;
+		return;
+	}
+
+	if (!sim->nibble_mode) {
+		// the low data lines are not wired so they read as 0
+		lcd_sim_exec(sim, rs, lcd_sim_nibble(sim->pins) << 4);
+	} else if (!sim->low_nibble) {
+		sim->latch = lcd_sim_nibble(sim->pins) << 4;
+		sim->low_nibble = true;
+	} else {
+		sim->low_nibble = false;
+		lcd_sim_exec(sim, rs, sim->latch | lcd_sim_nibble(sim->pins));
+	}
+}
+
+static void lcd_sim_set(struct lcd_sim *sim, unsigned int set_mask, unsigned int clear_mask)
+{
+	unsigned int old = sim->pins;
+
+	sim->sets++;
+	sim->pins = (old | set_mask) & ~clear_mask;
+
+	if (!(old & PWR) && (sim->pins & PWR)) {
+		lcd_sim_reset(sim);
+		sim->pins = (old | set_mask) & ~clear_mask;
+	} else if (!(sim->pins & PWR)) {
+		return;
+	} else if (!(old & E) && (sim->pins & E)) {
+		lcd_sim_e_rise(sim);
+	} else if ((old & E) && !(sim->pins & E)) {
+		lcd_sim_e_fall(sim);
+	}
+}
+
+static unsigned int lcd_sim_get(struct lcd_sim *sim, unsigned int get_mask)
+{
+	uint8_t nib;
+
+	sim->gets++;
+	if (!(sim->pins & PWR) || !(sim->pins & E) || !(sim->pins & RW))
+		return 0;
+
+	nib = sim->low_nibble ? sim->latch & 0x0f : sim->latch >> 4;
+	return ((nib & 0x1 ? D4 : 0) | (nib & 0x2 ? D5 : 0) | (nib & 0x4 ? D6 : 0) | (nib & 0x8 ? D7 : 0)) & get_mask;
+}
+
+// the visible chars of line y (buf must hold LCD_MAX_COLS + 1)
+static void lcd_sim_line(struct dio_t *dio, const struct lcd_map *map, int y, char *buf)
+{
+	int start = map->geo->start[y];
+	struct lcd_sim *sim = dio->sim[start >> 7];
+
+	if (sim)
+		memcpy(buf, &sim->ddram[start & 0x7f], map->cols);
+	else
+		memset(buf, ' ', map->cols);
+	buf[map->cols] = 0;
+}
+
+// the second simulated controller sees its own e line as e
+static unsigned int lcd_sim_pins(struct dio_t *dio, int k, unsigned int mask)
+{
+	if (!k)
+		return mask & ~dio->e[1];
+	return (mask & ~(dio->e[0] | dio->e[1])) | (mask & dio->e[1] ? E : 0);
+}
+
+// take the register lock, unless we are in a panic where a stopped cpu might
+// be holding it (the panic path goes ahead regardless)
+static bool dio_lock(struct dio_t *dio, unsigned long *flags)
+{
+	if (oops_in_progress)
+		return spin_trylock_irqsave(&dio->lock, *flags);
+	spin_lock_irqsave(&dio->lock, *flags);
+	return true;
+}
+
+static void dio_unlock(struct dio_t *dio, bool locked, unsigned long flags)
+{
+	if (locked)
+		spin_unlock_irqrestore(&dio->lock, flags);
+}
+
 static void dio_set(struct dio_t *dio, unsigned int set_mask, unsigned int clear_mask)
 {
 	unsigned int dir, out;
 	unsigned long flags;
 	unsigned int output_mask = set_mask | clear_mask;
+	bool locked;
+
+	lcd_capture_rec(set_mask, clear_mask);
 
-	// make these operations seemly atomic (at least
-	// on our single core system)
-	local_irq_save(flags);
+	if (dio->sim[0]) {
+		lcd_sim_set(dio->sim[0], lcd_sim_pins(dio, 0, set_mask), lcd_sim_pins(dio, 0, clear_mask));
+		if (dio->sim[1])
+			lcd_sim_set(dio->sim[1], lcd_sim_pins(dio, 1, set_mask), lcd_sim_pins(dio, 1, clear_mask));
+		return;
+	}
+
+	// other cpus share these registers
+	locked = dio_lock(dio, &flags);
 
 	// set and clear output state
 	out = ioread16(dio->out.vaddr);
@@ -180,17 +836,26 @@ static void dio_set(struct dio_t *dio, unsigned int set_mask, unsigned int clear
 	iowrite16(dir, dio->dir.vaddr);
 	mb();
 
-	local_irq_restore(flags);
+	dio_unlock(dio, locked, flags);
 }
 
 static unsigned int dio_get(struct dio_t *dio, unsigned int get_mask)
 {
 	unsigned int dir, in;
 	unsigned long flags;
+	bool locked;
+
+	if (dio->sim[0]) {
+		// only a controller with its e high drives the data lines
+		in = lcd_sim_get(dio->sim[0], get_mask);
+		if (dio->sim[1])
+			in |= lcd_sim_get(dio->sim[1], get_mask);
+		lcd_capture_rec(get_mask | LCD_CAPTURE_GET, in);
+		return in;
+	}
 
-	// make these operations seemly atomic (at least
-	// on our single core system)
-	local_irq_save(flags);
+	// other cpus share these registers
+	locked = dio_lock(dio, &flags);
 
 	// ensure these pins are inputs
 	dir = ioread16(dio->dir.vaddr);
@@ -204,7 +869,8 @@ static unsigned int dio_get(struct dio_t *dio, unsigned int get_mask)
 	mb();
 	in &= get_mask;
 	
-	local_irq_restore(flags);
+	dio_unlock(dio, locked, flags);
+	lcd_capture_rec(get_mask | LCD_CAPTURE_GET, in);
 	return in;
 }
 
@@ -216,6 +882,10 @@ static int dio_init(struct dio_t *dio)
 		return -EFAULT;
 	}
 
+	// nothing to map when simulating
+	if (dio->sim[0])
+		return 0;
+
 	// request dir, in, out regions
 	dio->dir.res = request_region(dio->dir.paddr, dio->dir.size, MODULE_NAME);
 	if (!dio->dir.res) {
@@ -255,6 +925,9 @@ static int dio_init(struct dio_t *dio)
 
 static void dio_deinit(struct dio_t *dio)
 {
+	if (dio->sim[0])
+		return;
+
 	// unmap virtual addresses of dir, in, out
 	if (dio->dir.vaddr)
 		iounmap(dio->dir.vaddr);
@@ -279,8 +952,9 @@ static void dio_deinit(struct dio_t *dio)
 }
 
 #define cond_to_dio_masks(cond, set, clear, bit) {if (cond) set |= bit; else clear |= bit;}
-static void lcd_write4(struct lcd_t *lcd, uint8_t rs, uint8_t db)
+static void lcd_bus_strobe4(struct lcd_t *lcd, uint8_t rs, uint8_t db)
 {
+	const struct lcd_timing *t = &lcd->timing;
 	unsigned int set = 0;
 	unsigned int clear = 0;
 
@@ -289,14 +963,14 @@ static void lcd_write4(struct lcd_t *lcd, uint8_t rs, uint8_t db)
 	dio_set(lcd->dio, set, clear | RW);
 
 	// wait for >= tsp1
-	ndelay(Tsp1 - Tr + Tm);
+	ndelay(t->tsp1 - t->tr + t->tm);
 
 	// set e hi
-	dio_set(lcd->dio, E, 0);
-	ndelay(Tr + Tm);
+	dio_set(lcd->dio, lcd->e, 0);
+	ndelay(t->tr + t->tm);
 
 	// hold e hi for >= tpw - tsp2
-	ndelay(Tpw - Tsp2 + Tm);
+	ndelay(t->tpw - t->tsp2 + t->tm);
 
 	// set/clear db
 	set = 0;
@@ -307,30 +981,177 @@ static void lcd_write4(struct lcd_t *lcd, uint8_t rs, uint8_t db)
 	cond_to_dio_masks((db & (1 << 7)), set, clear, D7);
 	dio_set(lcd->dio, set, clear);
 	
-	// hack for TS8500: even though u10 is powered off it still adds a lot of capacitance
-	// the d5 line, this takes 5us to die away so we add a 10us delay here to handle that
-	// on the real fls this should not be needed as there is no u10
-	udelay(50);
+	// let the data lines settle (see lcd_timings)
+	if (t->tcap)
+		udelay(t->tcap);
 	
 	// hold db and enable for >= tps2
-	ndelay(Tsp2 + Tm);
+	ndelay(t->tsp2 + t->tm);
 
 	// set e lo
-	dio_set(lcd->dio, 0, E);
-	ndelay(Tf + Tm);
+	dio_set(lcd->dio, 0, lcd->e);
+	ndelay(t->tf + t->tm);
+	lcd->strobes++;
 
 	// wait for >= thd1 + tf
-	ndelay(Tc - Tr - Tpw - Tf + Tm);
+	ndelay(t->tc - t->tr - t->tpw - t->tf + t->tm);
+}
+
+static void lcd_bus_write4(struct lcd_t *lcd, uint8_t rs, uint8_t db)
+{
+	if (lcd_fault(drop))
+		return;
+	if (lcd_fault(flip))
+		db ^= 0x10 << (get_random_int() & 3);
+	lcd_bus_strobe4(lcd, rs, db);
+
+	// a duplicate is the one extra strobe however often the fault fires
+	if (lcd_fault(dup))
+		lcd_bus_strobe4(lcd, rs, db);
+}
+
+// forget everything we knew about the lcd's state
+static void lcd_forget(struct lcd_t *lcd)
+{
+	lcd->ac = -1;
+	lcd->control = -1;
+	lcd->entry = -1;
+	lcd->unshifted = false;
+	lcd->other = (struct lcd_ctrl){.ac = -1, .control = -1, .entry = -1, .last_cmd = LCD_CMD_NONE};
+}
+
+// talk to controller n from here on (on a panel with one that is always 0),
+// lcd_t keeps what we know of the selected controller and other the rest
+static void lcd_select(struct lcd_t *lcd, int n)
+{
+	lcd->e = lcd->dio->e[n];
+	if (n == lcd->sel)
+		return;
+
+	swap(lcd->ac, lcd->other.ac);
+	swap(lcd->control, lcd->other.control);
+	swap(lcd->entry, lcd->other.entry);
+	swap(lcd->unshifted, lcd->other.unshifted);
+	swap(lcd->last_cmd, lcd->other.last_cmd);
+	swap(lcd->last_issue, lcd->other.last_issue);
+	swap(lcd->ready, lcd->other.ready);
+	lcd->sel = n;
+}
+
+// strobe every controller at once until the next lcd_select(), for writes
+// only as two controllers reading would fight over the data lines
+static void lcd_select_all(struct lcd_t *lcd)
+{
+	int k;
+
+	lcd->e = 0;
+	for (k = 0; k < lcd->map->ctrls; k++)
+		lcd->e |= lcd->dio->e[k];
+}
+
+static void lcd_write4(struct lcd_t *lcd, uint8_t rs, uint8_t db)
+{
+	// a lone nibble leaves the lcd in a state neither the busy model nor
+	// the command queue know anything about
+	lcd->last_cmd = LCD_CMD_NONE;
+	lcd->ready = false;
+	lcd_forget(lcd);
+
+	lcd_bus_write4(lcd, rs, db);
+}
+
+static enum lcd_cmd_class lcd_cmd_class(uint8_t rs, uint8_t db)
+{
+	if (rs)
+		return LCD_CMD_DATA;
+	if (db & 0xc0)
+		return LCD_CMD_ADDR;
+	if (db < 0x04)
+		return LCD_CMD_HOME;
+	return LCD_CMD_CTRL;
+}
+
+static void lcd_model_issue(struct lcd_t *lcd, enum lcd_cmd_class cls)
+{
+	lcd->last_cmd = cls;
+	lcd->last_issue = ktime_get();
+	lcd->ready = false;
+}
+
+// follow the address counter over a data read or write
+static void lcd_track_data(struct lcd_t *lcd)
+{
+	if (lcd->ac < 0 || lcd->entry != (0x04 | lcd_id_right | lcd_sh_off))
+		lcd->ac = -1;
+	else
+		lcd->ac = lcd_ac_next(lcd->ac);
+}
+
+// follow what a command does to the lcd's state
+static void lcd_track(struct lcd_t *lcd, uint8_t rs, uint8_t db)
+{
+	if (rs) {
+		lcd_track_data(lcd);
+		return;
+	}
+
+	lcd->queue.sent++;
+	if (db & 0x80) {
+		lcd->ac = (lcd->sel << 7) | (db & 0x7f);
+	} else if (db & 0x40) {
+		lcd->ac = -1;		// cgram address
+	} else if (db & 0x20) {
+		// function set
+	} else if (db & 0x10) {
+		lcd->ac = -1;		// cursor or display shift
+		lcd->unshifted = false;
+	} else if (db & 0x08) {
+		lcd->control = db;
+	} else if (db & 0x04) {
+		lcd->entry = db;
+	} else if (db & 0x03) {
+		lcd->ac = lcd->sel << 7;	// clear or home
+		lcd->unshifted = true;
+	}
+}
+
+static bool lcd_sync_addr(struct lcd_t *lcd, bool ready);
+static int lcd_busy_wait(struct lcd_t *lcd);
+static int lcd_idle_wait(struct lcd_t *lcd);
+
+static void lcd_bus_write8(struct lcd_t *lcd, uint8_t rs, uint8_t db)
+{
+	lcd_bus_write4(lcd, rs, db);        // upper nibble first
+	lcd_bus_write4(lcd, rs, db << 4);   // then lower nibble
+	lcd->cmds++;
+	lcd_model_issue(lcd, lcd_cmd_class(rs, db));
+	lcd_track(lcd, rs, db);
 }
 
 static void lcd_write8(struct lcd_t *lcd, uint8_t rs, uint8_t db)
 {
-	lcd_write4(lcd, rs, db);        // upper nibble first
-	lcd_write4(lcd, rs, db << 4);   // then lower nibble
+	// chars go where the cursor is, set the address if it moved
+	if (rs && lcd_sync_addr(lcd, true))
+		lcd_busy_wait(lcd);
+
+	lcd_bus_write8(lcd, rs, db);
+
+	// every other command is for the whole panel, the other controller
+	// gets it while this one is still busy with it (and only shows the
+	// cursor once that moves over to it, see lcd_queue_flush())
+	if (!rs && !(db & 0x80) && lcd->map->ctrls > 1) {
+		if ((db & 0xf8) == 0x08)
+			db &= ~(lcd_cursor_on | lcd_blink_on);
+		lcd_select(lcd, !lcd->sel);
+		lcd_idle_wait(lcd);
+		lcd_bus_write8(lcd, rs, db);
+		lcd_select(lcd, !lcd->sel);
+	}
 }
 
 static uint8_t lcd_read4(struct lcd_t *lcd, uint8_t rs)
 {
+	const struct lcd_timing *t = &lcd->timing;
 	uint8_t db = 0, tmp;
 	unsigned int set = 0;
 	unsigned int clear = 0;
@@ -340,19 +1161,18 @@ static uint8_t lcd_read4(struct lcd_t *lcd, uint8_t rs)
 	dio_set(lcd->dio, set | RW, clear);
 
 	// wait for >= tsp1
-	ndelay(Tsp1 - Tr + Tm);
+	ndelay(t->tsp1 - t->tr + t->tm);
 
 	// set e hi
-	dio_set(lcd->dio, E, 0);
-	ndelay(Tr + Tm);
+	dio_set(lcd->dio, lcd->e, 0);
+	ndelay(t->tr + t->tm);
 
 	// hold e hi for >= tpw - tsp2
-	ndelay(Td - Tr + Tm);
+	ndelay(t->td - t->tr + t->tm);
 
-	// hack for TS8500: even though u10 is powered off it still adds a lot of capacitance
-	// the d5 line, this takes 5us to die away so we add a 10us delay here to handle that
-	// on the real fls this should not be needed as there is no u10
-	udelay(50);
+	// let the data lines settle (see lcd_timings)
+	if (t->tcap)
+		udelay(t->tcap);
 
 	// set/clear db
 	tmp = dio_get(lcd->dio, D4 | D5 | D6 | D7);
@@ -362,14 +1182,15 @@ static uint8_t lcd_read4(struct lcd_t *lcd, uint8_t rs)
 	db |= tmp & D7 ? (1 << 7): 0;
 	
 	// hold db and enable for >= tps2
-	ndelay(Tpw + Tr - Td + Tm);
+	ndelay(t->tpw + t->tr - t->td + t->tm);
 	
 	// set e lo
-	dio_set(lcd->dio, 0, E);
-	ndelay(Tf + Tm);
+	dio_set(lcd->dio, 0, lcd->e);
+	ndelay(t->tf + t->tm);
+	lcd->strobes++;
 
 	// wait for >= thd1 + tf
-	ndelay(Tc - Tr - Tpw - Tf + Tm);
+	ndelay(t->tc - t->tr - t->tpw - t->tf + t->tm);
 
 	return db;
 }
@@ -377,64 +1198,246 @@ static uint8_t lcd_read4(struct lcd_t *lcd, uint8_t rs)
 static uint8_t lcd_read8(struct lcd_t *lcd, uint8_t rs)
 {
 	uint8_t db = 0;
+
+	if (rs && lcd_sync_addr(lcd, true))
+		lcd_busy_wait(lcd);
+
 	db |= (lcd_read4(lcd, rs) >> 0) & 0xf0;
 	db |= (lcd_read4(lcd, rs) >> 4) & 0x0f;
+
+	// reading data moves the address counter which keeps the lcd busy too
+	if (rs) {
+		lcd_model_issue(lcd, LCD_CMD_DATA);
+		lcd_track_data(lcd);
+	}
 	return db;
 }
 
+static void lcd_power_off(struct lcd_t *lcd)
+{
+	dio_set(lcd->dio, 0, PWR);
+	lcd->powered = false;
+}
+
+// wait ms, sleeping if the caller can (resume, on the engine thread) and
+// spinning if not (init, calibration and the panic path)
+static void lcd_por_delay(unsigned int ms, bool sleep)
+{
+	if (sleep)
+		msleep(ms);
+	else
+		mdelay(ms);
+}
+
+static void lcd_power_on(struct lcd_t *lcd, bool sleep)
+{
+	dio_set(lcd->dio, PWR, 0);
+	lcd_por_delay(Tpor0, sleep);
+	lcd->powered = true;
+	lcd_forget(lcd);
+}
+
 static void lcd_power_cycle(struct lcd_t *lcd)
 {
 	// ensure power is off for enough time for the lcd to power down
-	dio_set(lcd->dio, 0, PWR);
+	lcd_power_off(lcd);
 	mdelay(Tpor0);
 
 	// power on 
-	dio_set(lcd->dio, PWR, 0);
-	mdelay(Tpor0);
+	lcd_power_on(lcd, false);
 }
 
 static enum lcd_busy_state lcd_is_busy(struct lcd_t *lcd, uint8_t *addr)
 {
 	uint8_t db;
 	db = lcd_read8(lcd, 0);
+	if (lcd_fault(busy))
+		db |= lcd_busy;
 	if (addr)
-		*addr = db & 0x7f;
+		*addr = (lcd->sel << 7) | (db & 0x7f);
 	return db & 0x80;
 }
 
-static int lcd_busy_wait(struct lcd_t *lcd)
+// a recovery can run into another (a resync that has to wait out a stuck busy
+// flag), that is all the one event
+static void lcd_recovery_begin(struct lcd_t *lcd)
+{
+	if (lcd->recovery_depth++)
+		return;
+	lcd->recovery.events++;
+	lcd->recovery_start = ktime_get();
+	lcd->recovery_strobes = lcd->strobes;
+}
+
+static void lcd_recovery_end(struct lcd_t *lcd, bool ok)
+{
+	struct lcd_recovery *r = &lcd->recovery;
+	u64 ns;
+
+	if (--lcd->recovery_depth)
+		return;
+	ns = ktime_to_ns(ktime_sub(ktime_get(), lcd->recovery_start));
+	if (!ok)
+		r->failed++;
+	r->strobes += lcd->strobes - lcd->recovery_strobes;
+	r->ns += ns;
+	if (ns > r->max_ns)
+		r->max_ns = ns;
+}
+
+// start the busy model over from the datasheet
+static void lcd_model_reset(struct lcd_t *lcd)
+{
+	static const unsigned int seed[LCD_CMD_CLASSES] = {
+		[LCD_CMD_HOME] = Texec_home,
+		[LCD_CMD_DATA] = Texec_data,
+		[LCD_CMD_ADDR] = Texec_addr,
+		[LCD_CMD_CTRL] = Texec_ctrl,
+	};
+	int k;
+
+	memset(lcd->model, 0, sizeof(lcd->model));
+	for (k = 0; k < LCD_CMD_CLASSES; k++)
+		lcd->model[k].est = seed[k];
+	lcd->last_cmd = LCD_CMD_NONE;
+}
+
+// wait out the predicted execution time of the last command, returns true if
+// the prediction is trusted enough that the busy flag need not be polled
+static bool lcd_model_wait(struct lcd_t *lcd)
+{
+	struct lcd_cmd_model *m = &lcd->model[lcd->last_cmd];
+	bool learning = m->hits < LCD_MODEL_CONFIDENT;
+	s64 left;
+
+	// while learning only wait half the estimate so the polling that
+	// follows gets to see when the lcd really finished
+	m->issued++;
+	left = (s64)(learning ? m->est / 2 : m->est) - ktime_to_ns(ktime_sub(ktime_get(), lcd->last_issue));
+	if (left > 1000000)
+		usleep_range(DIV_ROUND_UP(left, 1000), DIV_ROUND_UP(left, 1000) + 100);
+	else if (left > 0)
+		udelay(DIV_ROUND_UP(left, 1000));
+
+	if (!learning && m->issued % LCD_MODEL_VERIFY) {
+		m->predicted++;
+		return true;
+	}
+	m->polled++;
+	return false;
+}
+
+// refine the model from a poll, first_poll says the lcd was already idle on
+// the first poll after the wait
+static void lcd_model_update(struct lcd_t *lcd, bool first_poll)
+{
+	struct lcd_cmd_model *m = &lcd->model[lcd->last_cmd];
+	unsigned int t = ktime_to_ns(ktime_sub(ktime_get(), lcd->last_issue));
+
+	if (m->hits < LCD_MODEL_CONFIDENT) {
+		// the prediction becomes the slowest we timed (plus margin),
+		// never anything shorter as that would mean talking to a busy lcd
+		if (t > m->worst)
+			m->worst = t;
+		if (++m->hits == LCD_MODEL_CONFIDENT) {
+			m->est = m->worst + (m->worst >> 3);
+			m->worst = 0;
+		}
+		return;
+	}
+
+	// a verify poll that found the lcd still busy means we have been too
+	// optimistic, so go with what it took this time and learn again
+	if (!first_poll) {
+		m->est = t + (t >> 3);
+		m->hits = 0;
+	}
+}
+
+// wait for the selected controller to finish its last command
+static int lcd_idle_wait(struct lcd_t *lcd)
 {
+	bool first_poll = true;
+	ktime_t start;
 	int t = 0;
 
-	// busy wait initially 
-	while (t < 1000) { // wait up to 1ms max for lcd to be ready by busy waiting (this keeps normal operation responsive)
-		if (lcd_is_busy(lcd, NULL) == lcd_idle)
+	if (busy_model && lcd->ready)
+		return 0;
+
+	if (busy_model && lcd->last_cmd != LCD_CMD_NONE) {
+		// the model knows roughly when the last command finishes so
+		// wait for that and poll finely after it (if at all)
+		if (lcd_model_wait(lcd))
 			goto done;
-		udelay(500);
-		t += 500;
+
+		// up to 1ms of polling, timed as a status read can take far
+		// longer than the delay between them
+		start = ktime_get();
+		do {
+			if (lcd_is_busy(lcd, NULL) == lcd_idle) {
+				lcd_model_update(lcd, first_poll);
+				goto done;
+			}
+			udelay(Tpoll);
+			first_poll = false;
+		} while (ktime_to_ns(ktime_sub(ktime_get(), start)) < 1000 * NSEC_PER_USEC);
+	} else {
+		// busy wait initially 
+		while (t < 1000) { // wait up to 1ms max for lcd to be ready by busy waiting (this keeps normal operation responsive)
+			if (lcd_is_busy(lcd, NULL) == lcd_idle)
+				goto done;
+			udelay(500);
+			t += 500;
+		}
 	}
 
 	// if busy waiting fails then sleep
+	lcd_recovery_begin(lcd);
 	t = 0;
 	while (t < 2) { // wait up to 9ms max for lcd to be ready (for buggy connections or weird commands this keeps the os from dieing)
 		if (lcd_is_busy(lcd, NULL) == lcd_idle)
-			goto done;
+			goto recovered;
 		msleep(5);
 		t++;
 	}
 	if (lcd_is_busy(lcd, NULL) == lcd_idle)
-		goto done;
+		goto recovered;
 
 	if (!atomic_read(&busy)) // this is just a error message so the atomic race is not important here
 		printk(KERN_ERR "timed-out waiting for lcd to return from busy state\n");
 	atomic_set(&busy, 1);
+	lcd->recovery.busy_timeouts++;
+	lcd_recovery_end(lcd, false);
 	return -1;
 
+recovered:
+	lcd_recovery_end(lcd, true);
+
 done:
 	atomic_set(&busy, 0);
+	lcd->ready = true;
 	return 0;
 }
 
+static void lcd_queue_flush(struct lcd_t *lcd);
+
+static int lcd_busy_wait(struct lcd_t *lcd)
+{
+	// what comes next goes to the controller the cursor is on, the other
+	// one can carry on with whatever it was given meanwhile (and only the
+	// one the cursor is on shows it, see lcd_write8())
+	if (lcd->sel != lcd->pos >> 7) {
+		lcd_select(lcd, lcd->pos >> 7);
+		if (lcd->control >= 0 && (lcd->control & (lcd_cursor_on | lcd_blink_on)) != (lcd->cursor_state | lcd->blink_state))
+			lcd->control_pending = true;
+	}
+
+	// anything still queued has to go out before whatever follows
+	lcd_queue_flush(lcd);
+
+	return lcd_idle_wait(lcd);
+}
+
 void lcd_display_control(struct lcd_t *lcd, enum lcd_display d, enum lcd_cursor c, enum lcd_blink b)
 {
 	uint8_t db = 0x08;	// display control 
@@ -442,14 +1445,42 @@ void lcd_display_control(struct lcd_t *lcd, enum lcd_display d, enum lcd_cursor
 	// build command
 	db |= d | c | b;
 
-	// wait for the lcd to be ready before sending the command
-	lcd_busy_wait(lcd);
-	lcd_write8(lcd, 0, db);
-
 	// update states
 	lcd->display_state = d;
 	lcd->cursor_state = c;
 	lcd->blink_state = b;
+	lcd->control_pending = false;
+	if (peephole && lcd->control == db) {
+		lcd->queue.dropped++;
+		return;
+	}
+
+	// wait for the lcd to be ready before sending the command
+	lcd_busy_wait(lcd);
+	lcd_write8(lcd, 0, db);
+}
+
+// cursor and blink changes wait in the queue so those made together (as
+// most escapes do) go out as one display control
+static void lcd_queue_control(struct lcd_t *lcd)
+{
+	if (!peephole) {
+		lcd_display_control(lcd, lcd->display_state, lcd->cursor_state, lcd->blink_state);
+		return;
+	}
+	if (lcd->control_pending)
+		lcd->queue.merged++;
+	lcd->control_pending = true;
+}
+
+static void lcd_queue_flush(struct lcd_t *lcd)
+{
+	if (lcd->control_pending)
+		lcd_display_control(lcd, lcd->display_state, lcd->cursor_state, lcd->blink_state);
+
+	// a visible cursor has to be shown where it really is
+	if (lcd->cursor_state == lcd_cursor_on || lcd->blink_state == lcd_blink_on)
+		lcd_sync_addr(lcd, false);
 }
 
 static void lcd_function_set(struct lcd_t *lcd, enum lcd_lines n, enum lcd_font f)
@@ -469,554 +1500,2542 @@ static void lcd_function_set(struct lcd_t *lcd, enum lcd_lines n, enum lcd_font
 void lcd_cursor(struct lcd_t *lcd, bool enable)
 {
 	lcd->cursor_state = enable ? lcd_cursor_on: lcd_cursor_off;
-	lcd_display_control(lcd, lcd->display_state, lcd->cursor_state, lcd->blink_state);
+	lcd_queue_control(lcd);
 }
 
 void lcd_blink(struct lcd_t *lcd, bool enable)
 {
 	lcd->blink_state = enable ? lcd_blink_on: lcd_blink_off;
-	lcd_display_control(lcd, lcd->display_state, lcd->cursor_state, lcd->blink_state);
+	lcd_queue_control(lcd);
 }
 
-static void lcd_clear(struct lcd_t *lcd)
+
+// ns it takes to send a command of class cls, what the busy model expects
+// it to keep the lcd busy for plus its two nibbles on the bus
+static unsigned int lcd_cmd_cost(struct lcd_t *lcd, enum lcd_cmd_class cls)
+{
+	const struct lcd_timing *t = &lcd->timing;
+
+	return lcd->model[cls].est + 2 * (t->tc + 4 * t->tm + 1000 * t->tcap);
+}
+
+// account for a command as it would have been sent without frame mode
+static void lcd_naive(struct lcd_t *lcd, enum lcd_cmd_class cls, int ac)
+{
+	lcd->naive_ns += lcd_cmd_cost(lcd, cls);
+	lcd->naive_ac = ac;
+}
+
+static void lcd_clear(struct lcd_t *lcd)
 {
 	uint8_t db = 0x01;	// display clear
 
+	if (lcd->deferred) {
+		lcd_naive(lcd, LCD_CMD_HOME, 0);
+		memset(lcd->frame, ' ', sizeof(lcd->frame));
+		bitmap_fill(lcd->frame_dirty, LCD_ADDRS);
+		return;
+	}
+
+	// wait for the lcd to be ready before sending the command
+	lcd_busy_wait(lcd);
+	lcd_write8(lcd, 0, db);
+
+	// the whole dram is now spaces
+	memset(lcd->shadow, ' ', sizeof(lcd->shadow));
+	bitmap_fill(lcd->shadow_valid, LCD_ADDRS);
+}
+
+static void lcd_set_dram_addr(struct lcd_t *lcd, uint8_t addr)
+{
+	uint8_t db = 0x80;	// set dram address 
+
+	// build command (bit 7 of the address picks the controller)
+	db |= addr & 0x7f;
+	lcd->pos = addr;
+	if (lcd->deferred) {
+		if (lcd->naive_ac != addr)
+			lcd_naive(lcd, LCD_CMD_ADDR, addr);
+		return;
+	}
+
+	// only where the next char goes matters, so moves are just noted
+	// until there is one (or a cursor to show)
+	if (peephole) {
+		if (lcd->want >= 0)
+			lcd->queue.moves++;
+		lcd->want = addr;
+		return;
+	}
+
+	// wait for the lcd to be ready before sending the command
+	lcd_busy_wait(lcd);
+	lcd_write8(lcd, 0, db);
+}
+
+// send the last address set if there is one and it changes anything, true if
+// it went out (ready says the caller has already waited for the lcd)
+static bool lcd_sync_addr(struct lcd_t *lcd, bool ready)
+{
+	int addr = lcd->want;
+
+	if (addr < 0)
+		return false;
+	lcd->want = -1;
+	if (lcd->ac == addr) {
+		lcd->queue.dropped++;
+		return false;
+	}
+
+	// wait for the lcd to be ready before sending the command
+	if (!ready)
+		lcd_busy_wait(lcd);
+	lcd_write8(lcd, 0, 0x80 | (addr & 0x7f));
+	return true;
+}
+
+static void lcd_home(struct lcd_t *lcd)
+{
+	uint8_t db = 0x02;	// home 
+
+	// without a display shift to undo home is just a (much quicker)
+	// address set
+	if ((peephole || lcd->deferred) && lcd->unshifted) {
+		lcd->queue.homes++;
+		lcd_set_dram_addr(lcd, 0);
+		return;
+	}
+
+	// wait for the lcd to be ready before sending the command
+	lcd_busy_wait(lcd);
+	lcd_write8(lcd, 0, db);
+	lcd->pos = 0;
+}
+
+static void lcd_entry_mode(struct lcd_t *lcd, enum lcd_id id, enum lcd_sh sh)
+{
+	uint8_t db = 0x04;	// entry mode
+
+	// build command
+	db |= id | sh;
+	if (peephole && lcd->entry == db) {
+		lcd->queue.dropped++;
+		return;
+	}
+
 	// wait for the lcd to be ready before sending the command
 	lcd_busy_wait(lcd);
 	lcd_write8(lcd, 0, db);
 }
 
-static void lcd_home(struct lcd_t *lcd)
+// the print engine (escape parser and cursor addressing) is shared with the
+// host build, it needs the bus commands above and lcd_putchar()
+static void lcd_putchar(struct lcd_t *lcd, char c);
+#include "fls_lcd_engine.c"
+
+static char lcd_read_data(struct lcd_t *lcd, int addr)
+{
+	int ipos = lcd->pos;
+	char c;
+	
+	lcd_set_dram_addr(lcd, addr);
+	lcd_busy_wait(lcd);
+	c = (char)lcd_read8(lcd, 1);
+	lcd_set_dram_addr(lcd, ipos); // restore position when we entered
+
+	return c;
+}
+
+static void lcd_resync(struct lcd_t *lcd, int addr)
+{
+	lcd_write4(lcd, 1, 0); // hopefully this get the nibbles back in sync
+	// whatever went out of sync could have set anything
+	lcd_forget(lcd);
+	// Reinitializing to return to a known state after corruption
+	lcd_set_dram_addr(lcd, addr);
+	lcd_display_control(lcd, lcd->display_state, lcd->cursor_state, lcd->blink_state);
+	lcd_set_am(lcd, lcd->am);
+	lcd_busy_wait(lcd);
+}
+
+// whether the scrubber is checking the lcd in the background, it only runs
+// with the device node and a positive scrub
+static bool lcd_scrubbing(void)
+{
+#ifdef DEVNODE
+	return scrub > 0;
+#else
+	return false;
+#endif
+}
+
+static void lcd_putchar(struct lcd_t *lcd, char c)
+{
+	int ipos = lcd->pos;
+	char rc;
+	int retries = 5;
+	bool recovering = false;
+
+	if (lcd->deferred) {
+		lcd->frame[ipos] = c;
+		set_bit(ipos, lcd->frame_dirty);
+		lcd_naive(lcd, LCD_CMD_DATA, lcd_ac_next(ipos));
+		lcd_inc_pos(lcd);
+		return;
+	}
+
+	lcd->shadow[ipos] = c;
+	set_bit(ipos, lcd->shadow_valid);
+
+	while (--retries) {
+		// wait for the lcd to be ready before sending the command
+		lcd_busy_wait(lcd);
+		lcd_write8(lcd, 1, c);
+		lcd_inc_pos(lcd);
+
+		// the scrubber catches (and repairs) corruption in the
+		// background so there is no need to slow every char down
+		if (lcd_scrubbing())
+			return;
+
+		// check we wrote c to the screen (this is for debugging a
+		// problem where the lcd goes bananas)
+		rc = lcd_read_data(lcd, ipos);
+		if (rc == c) {
+			if (recovering)
+				lcd_recovery_end(lcd, true);
+			return;
+		}
+		if (!recovering) {
+			lcd_recovery_begin(lcd);
+			recovering = true;
+		}
+
+		// We failed to put the char we wanted, presumably this is the 
+		// nibble offset bug, so lets try to get back in sync, we also
+		// set the corrupt bit to let the sysfs know our lcd may need 
+		// redrawing (and emit a syslog error if this is the first 
+		// warning so we don't spam the logs)
+		if (!atomic_read(&corrupt)) // this is just a error message so the atomic race is not important here
+			printk(KERN_ERR "[ERR] wrote 0x%.2x and read 0x%.2x\n", c, rc);
+		atomic_set(&corrupt, 1);
+		lcd_resync(lcd, ipos);
+	}
+
+	lcd_recovery_end(lcd, false);
+}
+
+// the address counter steps through 0x00-0x27 then 0x40-0x67 and round again,
+// the planner numbers those places in that order, a second controller's
+// following on from the first's
+#define LCD_AC_CELLS  (80)
+#define LCD_AC_PLACES (LCD_CTRLS * LCD_AC_CELLS)
+
+static int lcd_ac_addr(int i)
+{
+	int k = i % LCD_AC_CELLS;
+
+	return (i / LCD_AC_CELLS) << 7 | (k < 40 ? k : 0x40 + k - 40);
+}
+
+static int lcd_ac_index(int addr)
+{
+	int k = addr & 0x7f;
+
+	return (addr >> 7) * LCD_AC_CELLS + (k < 0x40 ? k : k - 0x40 + 40);
+}
+
+// the place after i, the address counter goes round its own controller's
+static int lcd_ac_step(int i)
+{
+	return i % LCD_AC_CELLS == LCD_AC_CELLS - 1 ? i + 1 - LCD_AC_CELLS : i + 1;
+}
+
+// the place controller ctrl's address counter is at (-1 if we don't know)
+static int lcd_plan_ac(struct lcd_t *lcd, int ctrl)
+{
+	int ac = ctrl == lcd->sel ? lcd->ac : lcd->other.ac;
+
+	return ac < 0 ? -1 : lcd_ac_index(ac);
+}
+
+static bool lcd_addr_visible(struct lcd_t *lcd, int addr)
+{
+	return lcd->map->y[addr] >= 0;
+}
+
+struct lcd_plan {
+	bool clear;			// start with a display clear
+	bool step;			// data writes move the address counter on
+	int n;				// places that have to be written
+	uint8_t req[LCD_AC_PLACES];	// and which they are, in ac order
+	char val[LCD_AC_PLACES];	// what every place should end up as
+	bool fill[LCD_AC_PLACES];	// and if it may be rewritten with it
+	int first[LCD_CTRLS + 1];	// where each controller's reqs start
+	int start[LCD_CTRLS];		// and which of them to write first
+	unsigned int cost;		// ns
+};
+
+// cost of getting the address counter from place a to place r, with an
+// address set or by rewriting the places in between (*fill says which)
+static unsigned int lcd_plan_gap(struct lcd_t *lcd, struct lcd_plan *p, int a, int r, bool *fill)
+{
+	unsigned int addr = lcd_cmd_cost(lcd, LCD_CMD_ADDR);
+	unsigned int data = lcd_cmd_cost(lcd, LCD_CMD_DATA);
+	int gap = (r - a + LCD_AC_CELLS) % LCD_AC_CELLS;
+	int k;
+
+	*fill = true;
+	if (a == r)
+		return 0;
+	*fill = false;
+	if (a < 0 || !p->step || a / LCD_AC_CELLS != r / LCD_AC_CELLS || gap * data >= addr)
+		return addr;
+	for (k = a; k != r; k = lcd_ac_step(k))
+		if (!p->fill[k])
+			return addr;
+	*fill = true;
+	return gap * data;
+}
+
+// work out the cheapest way to take the lcd from the shadow to the frame,
+// with or without clearing it first (false if that can't be done)
+static bool lcd_plan(struct lcd_t *lcd, struct lcd_plan *p, bool clear)
+{
+	unsigned int gap[LCD_AC_CELLS], total, best = 0, c;
+	int i, n, addr, ac, ctrl;
+	bool dirty, known, valid, visible, fill;
+	uint8_t *req;
+	char was;
+
+	p->clear = clear;
+	p->step = clear || lcd->entry == (0x04 | lcd_id_right | lcd_sh_off);
+	p->n = 0;
+	for (i = 0; i < lcd->map->ctrls * LCD_AC_CELLS; i++) {
+		if (i % LCD_AC_CELLS == 0)
+			p->first[i / LCD_AC_CELLS] = p->n;
+		addr = lcd_ac_addr(i);
+		dirty = test_bit(addr, lcd->frame_dirty);
+		known = test_bit(addr, lcd->shadow_valid);
+		visible = lcd_addr_visible(lcd, addr);
+
+		// where the place has to end up (as it is unless the frame
+		// changed it) and what it holds before any writes
+		p->val[i] = dirty ? lcd->frame[addr] : lcd->shadow[addr];
+		was = clear ? ' ' : lcd->shadow[addr];
+		valid = clear || known;
+		p->fill[i] = dirty || known || !visible;
+		if (!visible)
+			continue;
+
+		// a clear would lose what we neither know nor were given, and
+		// what we know has to be put back unless it is a space
+		if (clear && !dirty && !known)
+			return false;
+		if ((dirty || clear) && (!valid || p->val[i] != was))
+			p->req[p->n++] = i;
+	}
+	p->first[lcd->map->ctrls] = p->n;
+
+	p->cost = clear ? lcd_cmd_cost(lcd, LCD_CMD_HOME) : 0;
+	if (!p->n)
+		return true;
+	p->cost += p->n * lcd_cmd_cost(lcd, LCD_CMD_DATA);
+
+	// each controller's writes go round in ac order so every gap between
+	// two of them is crossed except the one before the first, pick the
+	// first write that leaves out the dearest gap for what it costs to get
+	// to it
+	for (ctrl = 0; ctrl < lcd->map->ctrls; ctrl++) {
+		req = &p->req[p->first[ctrl]];
+		n = p->first[ctrl + 1] - p->first[ctrl];
+		p->start[ctrl] = 0;
+		total = 0;
+		for (i = 0; i < n; i++) {
+			gap[i] = lcd_plan_gap(lcd, p, lcd_ac_step(req[(i + n - 1) % n]), req[i], &fill);
+			total += gap[i];
+		}
+		ac = clear ? ctrl * LCD_AC_CELLS : lcd_plan_ac(lcd, ctrl);
+		for (i = 0; i < n; i++) {
+			c = total - gap[i] + lcd_plan_gap(lcd, p, ac, req[i], &fill);
+			if (i == 0 || c < best) {
+				best = c;
+				p->start[ctrl] = i;
+			}
+		}
+		if (n)
+			p->cost += best;
+	}
+	return true;
+}
+
+// a data write the planner asked for, the scrubber is left to catch any
+// that don't land
+static void lcd_flush_data(struct lcd_t *lcd, int i, char c)
+{
+	int addr = lcd_ac_addr(i);
+
+	lcd->shadow[addr] = c;
+	set_bit(addr, lcd->shadow_valid);
+	lcd->pos = addr;	// so the wait is for this place's controller
+	lcd_busy_wait(lcd);
+	lcd_write8(lcd, 1, c);
+}
+
+// send the frame's changes, starting with a clear if that is cheaper and
+// may_clear (a clear blanks the whole lcd for a moment)
+static void lcd_flush(struct lcd_t *lcd, bool may_clear)
+{
+	struct lcd_plan plan[2], *p = &plan[0];
+	int pos = lcd->pos;
+	int i, j, k, n, ac, ctrl, most = 0;
+	bool fill;
+
+	// the plan sets the address itself, whatever the engine left pending
+	lcd->want = -1;
+	lcd_plan(lcd, &plan[0], false);
+	if (may_clear && lcd_plan(lcd, &plan[1], true) && plan[1].cost < plan[0].cost)
+		p = &plan[1];
+
+	if (p->clear) {
+		lcd_clear(lcd);
+		lcd->plan.clears++;
+	}
+
+	// with two controllers their writes take turns, so each is busy with
+	// its last one while the other's goes out rather than waiting for it
+	for (ctrl = 0; ctrl < lcd->map->ctrls; ctrl++)
+		most = max(most, p->first[ctrl + 1] - p->first[ctrl]);
+	for (j = 0; j < most; j++) {
+		for (ctrl = 0; ctrl < lcd->map->ctrls; ctrl++) {
+			n = p->first[ctrl + 1] - p->first[ctrl];
+			if (j >= n)
+				continue;
+			i = p->req[p->first[ctrl] + (p->start[ctrl] + j) % n];
+			ac = lcd_plan_ac(lcd, ctrl);
+			lcd_plan_gap(lcd, p, ac, i, &fill);
+			if (fill) {
+				for (k = ac; k != i; k = lcd_ac_step(k)) {
+					lcd_flush_data(lcd, k, p->val[k]);
+					lcd->plan.fills++;
+				}
+			} else {
+				lcd_set_dram_addr(lcd, lcd_ac_addr(i));
+				lcd->plan.addrs++;
+			}
+			lcd_flush_data(lcd, i, p->val[i]);
+			lcd->plan.data++;
+		}
+	}
+
+	// leave the cursor where the engine thinks it is
+	lcd_set_dram_addr(lcd, pos);
+
+	lcd->plan.flushes++;
+	lcd->plan.planned_ns += p->cost;
+	lcd->plan.naive_ns += lcd->naive_ns;
+	bitmap_zero(lcd->frame_dirty, LCD_ADDRS);
+}
+
+// draw into the frame from here, until lcd_frame_end() sends what changed
+static void lcd_frame_begin(struct lcd_t *lcd)
+{
+	lcd->naive_ac = lcd->ac;
+	lcd->naive_ns = 0;
+	bitmap_zero(lcd->frame_dirty, LCD_ADDRS);
+	lcd->deferred = true;
+}
+
+// stop drawing into the frame and send it, may_clear as for lcd_flush()
+static void lcd_frame_end(struct lcd_t *lcd, bool may_clear)
+{
+	lcd->deferred = false;
+	lcd_flush(lcd, may_clear);
+}
+
+// check the next few visible cells against the shadow and rewrite the ones
+// that have diverged (call with the lock held)
+static void lcd_scrub(struct lcd_t *lcd, int cells)
+{
+	int ipos = lcd->pos;
+	int addr;
+	uint8_t ac;
+	char c;
+	bool bad;
+
+	while (cells--) {
+		addr = lcd->map->addr[lcd->scrub_cell];
+		lcd->scrub_cell = (lcd->scrub_cell + 1) % lcd->map->cells;
+		if (!test_bit(addr, lcd->shadow_valid))
+			continue;
+
+		// if the address counter did not take we have lost nibble sync,
+		// the set has to go out now for that to tell us anything (the
+		// command queue would hold it back until the read)
+		bad = false;
+		lcd_set_dram_addr(lcd, addr);
+		lcd_sync_addr(lcd, false);
+		lcd_busy_wait(lcd);
+		lcd_is_busy(lcd, &ac);
+		if (ac != addr) {
+			lcd->scrub_resyncs++;
+			lcd_recovery_begin(lcd);
+			bad = true;
+			lcd_resync(lcd, addr);
+		}
+
+		c = (char)lcd_read8(lcd, 1);
+		lcd->scrub_checked++;
+		if (c != lcd->shadow[addr]) {
+			lcd->scrub_repairs++;
+			if (!bad)
+				lcd_recovery_begin(lcd);
+			bad = true;
+			lcd_set_dram_addr(lcd, addr);
+			lcd_busy_wait(lcd);
+			lcd_write8(lcd, 1, lcd->shadow[addr]);
+		}
+
+		if (bad)
+			lcd_recovery_end(lcd, true);
+	}
+
+	lcd_set_dram_addr(lcd, ipos); // restore position when we entered
+}
+
+// the engine, every bit of bus work is handed to the one lcd-engine thread so
+// the scheduling (and cpu) the lcd gets can be set in one place, callers wait
+// for their work to be done
+struct lcd_engine_call {
+	struct kthread_work work;
+	long (*fn)(struct lcd_t *lcd, void *data);
+	void *data;
+	long ret;
+};
+
+static void lcd_engine_work(struct kthread_work *work)
+{
+	struct lcd_engine_call *call = container_of(work, struct lcd_engine_call, work);
+
+	mutex_lock(&lcd.lock);
+	call->ret = call->fn(&lcd, call->data);
+	mutex_unlock(&lcd.lock);
+}
+
+// run fn with the lock held on the engine thread (or here if there is none),
+// wake the lcd with lcd_pm_get() first, never from in the engine
+static long lcd_engine_run(long (*fn)(struct lcd_t *lcd, void *data), void *data)
+{
+	struct lcd_engine_call call = {.fn = fn, .data = data};
+
+	init_kthread_work(&call.work, lcd_engine_work);
+	if (!lcd.engine) {
+		lcd_engine_work(&call.work);
+		return call.ret;
+	}
+	queue_kthread_work(&lcd.worker, &call.work);
+	flush_kthread_work(&call.work);
+	return call.ret;
+}
+
+static void lcd_engine_start(struct lcd_t *lcd)
+{
+	static struct cpumask cpus;
+	struct task_struct *task;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 9, 0)
+	struct sched_param param = {.sched_priority = engine_policy == SCHED_NORMAL ? 0 : engine_prio};
+#endif
+
+	if (!engine)
+		return;
+	init_kthread_worker(&lcd->worker);
+	task = kthread_create(kthread_worker_fn, &lcd->worker, "lcd-engine");
+	if (IS_ERR(task)) {
+		printk(KERN_ERR "unable to start the lcd engine, running bus work in place\n");
+		return;
+	}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 9, 0)
+	if (sched_setscheduler(task, engine_policy, &param))
+		printk(KERN_ERR "lcd engine policy %d priority %d not allowed\n", engine_policy, engine_prio);
+	if (engine_policy == SCHED_NORMAL)
+		set_user_nice(task, engine_prio);
+#else
+	// modules only get fifo at the fixed rt priority now, say so rather
+	// than run the engine at something other than what was asked for
+	if (engine_policy == SCHED_NORMAL)
+		sched_set_normal(task, engine_prio);
+	else
+		sched_set_fifo(task);
+	if (engine_policy != SCHED_NORMAL && (engine_policy != SCHED_FIFO || engine_prio != MAX_RT_PRIO / 2))
+		printk(KERN_WARNING "lcd engine policy %d priority %d not available, using fifo priority %d\n",
+			engine_policy, engine_prio, MAX_RT_PRIO / 2);
+#endif
+	if (engine_cpus) {
+		if (cpulist_parse(engine_cpus, &cpus) || set_cpus_allowed_ptr(task, &cpus))
+			printk(KERN_ERR "bad lcd engine cpu list %s, running on any\n", engine_cpus);
+	}
+
+	lcd->engine = task;
+	wake_up_process(task);
+}
+
+static void lcd_engine_stop(struct lcd_t *lcd)
+{
+	if (!lcd->engine)
+		return;
+	flush_kthread_worker(&lcd->worker);
+	kthread_stop(lcd->engine);
+	lcd->engine = NULL;
+}
+
+static void lcd_scrub_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(scrub_work, lcd_scrub_work);
+
+static long lcd_scrub_idle(struct lcd_t *lcd, void *data)
+{
+	// stay out of the way of writers, we will get another go
+	if (!lcd->suspended && time_after(jiffies, lcd->last_write + LCD_SCRUB_IDLE))
+		lcd_scrub(lcd, LCD_SCRUB_CELLS);
+	return 0;
+}
+
+static void lcd_scrub_work(struct work_struct *work)
+{
+	lcd_engine_run(lcd_scrub_idle, NULL);
+	schedule_delayed_work(&scrub_work, msecs_to_jiffies(scrub));
+}
+
+static void lcd_4bit_init(struct lcd_t *lcd, enum lcd_lines lines, enum lcd_font font, bool sleep)
+{
+	// force us into 8 bit mode (just to get to a known sync point), every
+	// controller at once
+	lcd_select_all(lcd);
+	lcd_write4(lcd, 0, 0x30);
+	lcd_por_delay(Tpor1, sleep);
+	lcd_write4(lcd, 0, 0x30);
+	udelay(Tpor2);
+	lcd_write4(lcd, 0, 0x30);
+	udelay(Tpor3);
+
+	// goto 4 bit mode (setting the number of lines and font)
+	// note we are only able to run this function set at this stage and never again (see datasheet p16, and
+	// http://www.piclist.com/techref/postbot.asp?by=thread&id=HD44780+LCD+and+4-bit+mode+using+16F84&w=body&tgt=post)
+	lcd_write4(lcd, 0, 0x20);
+	udelay(Tpor4);
+	lcd_select(lcd, 0);
+	
+	// set initial startup settings recommended in the datasheet
+	lcd_function_set(lcd, lcd_lines_2, lcd_font_5by8);
+	lcd_display_control(lcd, lcd_display_off, lcd_cursor_off, lcd_blink_off); // turn everything off
+	lcd_entry_mode(lcd, lcd_id_right, lcd_sh_off);
+}
+
+// the panic path, by then other cpus are stopped (perhaps holding the lock or
+// half way through a command) and we can't sleep, so this talks to the bus
+// directly, polling the busy flag for a bounded time, and never touches the
+// queue or the shadow
+
+static void lcd_panic_write8(struct lcd_t *lcd, uint8_t rs, uint8_t db)
+{
+	u64 start = lcd_fast_ns();
+
+	// if the busy flag never clears send it anyway, better a garbled
+	// message than a hung panic, the bound is on the time taken as each
+	// read is itself slow
+	while (lcd_read8(lcd, 0) & lcd_busy) {
+		if (lcd_fast_ns() - start >= Tpanic * NSEC_PER_USEC)
+			break;
+		udelay(Tpoll);
+	}
+	lcd_bus_write4(lcd, rs, db);
+	lcd_bus_write4(lcd, rs, db << 4);
+}
+
+// fill line y from s, returning what didn't fit
+static const char *lcd_panic_line(struct lcd_t *lcd, int y, const char *s)
+{
+	int x;
+	char c;
+
+	lcd_select(lcd, lcd->map->geo->start[y] >> 7);
+	lcd_panic_write8(lcd, 0, 0x80 | (lcd->map->geo->start[y] & 0x7f));
+	for (x = 0; x < lcd->map->cols; x++) {
+		c = *s && *s != '\n' ? *s++ : ' ';
+		lcd_panic_write8(lcd, 1, c >= 0x20 && c < 0x7f ? c : '?');
+	}
+	return s;
+}
+
+static int lcd_panic_notify(struct notifier_block *nb, unsigned long event, void *ptr)
+{
+	const char *msg = ptr ? ptr : "";
+	int y, k;
+
+	if (!lcd.powered)
+		lcd_power_on(&lcd, false);
+
+	// let whatever the lcd was doing finish, then whatever nibble it was
+	// expecting this gets it back in sync (see lcd_4bit_init()), then put
+	// the settings back as we need them
+	udelay(Tpanic);
+	lcd_select_all(&lcd);
+	lcd_write4(&lcd, 0, 0x30);
+	mdelay(Tpor1);
+	lcd_write4(&lcd, 0, 0x30);
+	udelay(Tpor2);
+	lcd_write4(&lcd, 0, 0x30);
+	udelay(Tpor3);
+	lcd_write4(&lcd, 0, 0x20);
+	udelay(Tpor4);
+	for (k = 0; k < lcd.map->ctrls; k++) {
+		lcd_select(&lcd, k);
+		lcd_panic_write8(&lcd, 0, 0x20 | lcd_4bit | lcd_lines_2 | lcd_font_5by8);
+		lcd_panic_write8(&lcd, 0, 0x08 | lcd_display_on | lcd_cursor_off | lcd_blink_off);
+		lcd_panic_write8(&lcd, 0, 0x04 | lcd_id_right | lcd_sh_off);
+		lcd_panic_write8(&lcd, 0, 0x02);	// home, to undo any display shift
+	}
+
+	lcd_panic_line(&lcd, 0, "KERNEL PANIC");
+	for (y = 1; y < lcd.map->lines; y++)
+		msg = lcd_panic_line(&lcd, y, msg);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block lcd_panic_nb = {
+	.notifier_call = lcd_panic_notify,
+};
+
+static int lcd_timing_select(struct lcd_t *lcd, const char *name)
+{
+	int k;
+
+	for (k = 0; k < ARRAY_SIZE(lcd_timings); k++) {
+		if (sysfs_streq(name, lcd_timings[k].name)) {
+			lcd->timing = lcd_timings[k];
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+// calibration candidates (fastest last) and where to test them, 0x20-0x27 is
+// off screen on the 16 column panels and 20x2 but shown on 20x4 and the 40
+// column ones, which is fine as calibration only runs from lcd_init()
+// with the display still off and the clear after it wipes the pattern
+static const int lcd_calib_tcap[] = {50, 20, 10, 5, 2, 1, 0};
+static const int lcd_calib_tm[] = {50, 40, 30, 20, 10, 0};
+#define LCD_CALIB_ADDR   (0x20)
+#define LCD_CALIB_ROUNDS (4)
+
+static bool lcd_calib_check(struct lcd_t *lcd)
+{
+	static const uint8_t pattern[] = {0x55, 0xaa, 0x33, 0xcc, 0x0f, 0xf0, 0x5a, 0xa5};
+	uint8_t addr;
+	int r, k;
+
+	for (r = 0; r < LCD_CALIB_ROUNDS; r++) {
+		lcd_set_dram_addr(lcd, LCD_CALIB_ADDR);
+		for (k = 0; k < ARRAY_SIZE(pattern); k++) {
+			if (lcd_busy_wait(lcd))
+				return false;
+			lcd_write8(lcd, 1, pattern[k] ^ (r * 0x11));
+		}
+
+		lcd_set_dram_addr(lcd, LCD_CALIB_ADDR);
+		for (k = 0; k < ARRAY_SIZE(pattern); k++) {
+			if (lcd_busy_wait(lcd))
+				return false;
+			if (lcd_read8(lcd, 1) != (uint8_t)(pattern[k] ^ (r * 0x11)))
+				return false;
+		}
+
+		// a nibble slip would also show up in the address counter
+		if (lcd_busy_wait(lcd))
+			return false;
+		lcd_is_busy(lcd, &addr);
+		if (addr != LCD_CALIB_ADDR + ARRAY_SIZE(pattern))
+			return false;
+	}
+
+	return true;
+}
+
+static void lcd_calib_field(struct lcd_t *lcd, int *field, const int *steps, int n)
+{
+	int safe = *field;
+	int k, good = -1;
+
+	for (k = 0; k < n; k++) {
+		if (steps[k] > safe)
+			continue;
+		*field = steps[k];
+		if (!lcd_calib_check(lcd)) {
+			// we have probably lost nibble sync so go back to what
+			// worked and resync from scratch
+			*field = safe;
+			lcd_4bit_init(lcd, lcd_lines_2, lcd_font_5by8, false);
+			break;
+		}
+		good = k;
+	}
+
+	// keep one step slower than the fastest setting that worked as margin
+	if (good > 0 && steps[good - 1] <= safe)
+		*field = steps[good - 1];
+	else
+		*field = safe;
+}
+
+static void lcd_calibrate(struct lcd_t *lcd)
+{
+	// settle time first as it is by far the biggest cost per nibble
+	lcd_calib_field(lcd, &lcd->timing.tcap, lcd_calib_tcap, ARRAY_SIZE(lcd_calib_tcap));
+	lcd_calib_field(lcd, &lcd->timing.tm, lcd_calib_tm, ARRAY_SIZE(lcd_calib_tm));
+	printk(KERN_INFO "lcd timing calibrated to tcap = %dus, tm = %dns\n", lcd->timing.tcap, lcd->timing.tm);
+}
+
+// adopt whatever is already on the lcd (eg left by a previous load of this
+// module, or the kernel before a kexec) by reading it into the shadow
+static void lcd_attach(struct lcd_t *lcd)
+{
+	uint8_t ac;
+	int cell, addr;
+
+	lcd_busy_wait(lcd);
+	lcd_is_busy(lcd, &ac);
+
+	for (cell = 0; cell < lcd->map->cells; cell++) {
+		addr = lcd->map->addr[cell];
+		if (cell % lcd->map->cols == 0)
+			lcd_set_dram_addr(lcd, addr);
+		lcd_busy_wait(lcd);
+		lcd->shadow[addr] = (char)lcd_read8(lcd, 1);
+		set_bit(addr, lcd->shadow_valid);
+	}
+
+	// display control is write only so assume it is how lcd_init leaves it
+	lcd->display_state = lcd_display_on;
+	lcd->cursor_state = lcd_cursor_off;
+	lcd->blink_state = lcd_blink_off;
+
+	// and carry on from where the cursor was
+	lcd_set_dram_addr(lcd, ac);
+}
+
+// put glyph k into cgram on every controller, data writes don't go to both
+// so each gets its rows in turn, and the address counter is left in cgram
+// so the next char needs the dram address set again
+static void lcd_glyph_load(struct lcd_t *lcd, int k)
+{
+	int ctrl, row;
+
+	lcd_queue_flush(lcd);
+	lcd_busy_wait(lcd);
+	lcd_write8(lcd, 0, 0x40 | (k << 3));
+	for (row = 0; row < 8; row++) {
+		for (ctrl = 0; ctrl < lcd->map->ctrls; ctrl++) {
+			lcd_select(lcd, ctrl);
+			lcd_idle_wait(lcd);
+			lcd_bus_write8(lcd, 1, lcd_glyph_rows[k][row]);
+		}
+	}
+	lcd_set_dram_addr(lcd, lcd->pos);
+}
+
+// put the shadow back on a freshly initialised lcd (call with the lock held)
+static void lcd_restore(struct lcd_t *lcd)
+{
+	char shadow[LCD_ADDRS];
+	DECLARE_BITMAP(valid, LCD_ADDRS);
+	int cell, addr, ac = -1;
+	int k;
+
+	// cgram doesn't survive losing power either
+	for (k = 0; k < LCD_GLYPHS; k++)
+		if (lcd_charset.glyph[k])
+			lcd_glyph_load(lcd, k);
+
+	// clearing is the quickest way to get rid of whatever is in dram
+	// after power up, but it also wipes the shadow we are restoring
+	memcpy(shadow, lcd->shadow, sizeof(shadow));
+	memcpy(valid, lcd->shadow_valid, sizeof(valid));
+	lcd_clear(lcd);
+	memcpy(lcd->shadow, shadow, sizeof(shadow));
+	memcpy(lcd->shadow_valid, valid, sizeof(valid));
+
+	for (cell = 0; cell < lcd->map->cells; cell++) {
+		addr = lcd->map->addr[cell];
+		if (!test_bit(addr, valid) || shadow[addr] == ' ')
+			continue;
+		if (addr != ac)
+			lcd_set_dram_addr(lcd, addr);
+		lcd_busy_wait(lcd);
+		lcd_write8(lcd, 1, shadow[addr]);
+		ac = lcd_ac_next(addr);
+	}
+}
+
+static void lcd_suspend(struct lcd_t *lcd)
+{
+	enum lcd_display d = lcd->display_state;
+
+	if (power_down) {
+		lcd_power_off(lcd);
+	} else {
+		// keep display_state so resume knows what to go back to
+		lcd_display_control(lcd, lcd_display_off, lcd->cursor_state, lcd->blink_state);
+		lcd->display_state = d;
+	}
+	lcd->suspended = true;
+}
+
+static void lcd_resume(struct lcd_t *lcd)
+{
+	enum lcd_display d = lcd->display_state;
+	enum lcd_cursor c = lcd->cursor_state;
+	enum lcd_blink b = lcd->blink_state;
+	ktime_t start = ktime_get();
+	int pos = lcd->pos;
+
+	if (!lcd->powered) {
+		// the lcd has forgotten everything so replay the init and
+		// put back what was on the screen
+		lcd_power_on(lcd, true);
+		lcd_4bit_init(lcd, lcd_lines_2, lcd_font_5by8, true);
+		lcd_restore(lcd);
+		lcd_set_dram_addr(lcd, pos);
+	}
+	lcd_display_control(lcd, d, c, b);
+	lcd->suspended = false;
+
+	lcd->resumes++;
+	lcd->resume_last = ktime_us_delta(ktime_get(), start);
+	if (lcd->resume_last > lcd->resume_max)
+		lcd->resume_max = lcd->resume_last;
+}
+
+static long lcd_engine_suspend(struct lcd_t *lcd, void *data)
+{
+	lcd_suspend(lcd);
+	return 0;
+}
+
+static long lcd_engine_resume(struct lcd_t *lcd, void *data)
+{
+	lcd_resume(lcd);
+	return 0;
+}
+
+static int lcd_runtime_suspend(struct device *dev)
+{
+	lcd_engine_run(lcd_engine_suspend, NULL);
+	return 0;
+}
+
+static int lcd_runtime_resume(struct device *dev)
+{
+	lcd_engine_run(lcd_engine_resume, NULL);
+	return 0;
+}
+
+static const struct dev_pm_ops lcd_pm_ops = {
+	.runtime_suspend = lcd_runtime_suspend,
+	.runtime_resume = lcd_runtime_resume,
+};
+
+// wake the lcd up before touching the bus (call without the lock held)
+static void lcd_pm_get(struct lcd_t *lcd)
+{
+	if (lcd->dev)
+		pm_runtime_get_sync(lcd->dev);
+}
+
+// restart the autosuspend timer once done with the bus
+static void lcd_pm_put(struct lcd_t *lcd)
+{
+	if (lcd->dev) {
+		pm_runtime_mark_last_busy(lcd->dev);
+		pm_runtime_put_autosuspend(lcd->dev);
+	}
+}
+
+// the console, messages are only copied into a few lines of text as they are
+// printed (often with interrupts off, and the bus is far too slow for that) and
+// drawn from a work item at most every con_rate ms, so a printk storm just
+// shows its latest lines
+static struct lcd_con {
+	spinlock_t lock;
+	uint32_t text[LCD_MAX_LINES][LCD_MAX_COLS];	// code points
+	struct lcd_utf8 utf8;
+	int col;
+	bool nl;			// the next char starts a new line
+	bool queued;			// a redraw is scheduled
+	unsigned long msgs;
+	unsigned long redraws;
+} lcd_con = {
+	.lock = __SPIN_LOCK_UNLOCKED(lcd_con.lock),
+};
+
+static void lcd_con_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(con_work, lcd_con_work);
+
+// blank count cells of line
+static void lcd_con_blank(uint32_t *line, int count)
+{
+	while (count--)
+		*line++ = ' ';
+}
+
+static void lcd_con_put(struct lcd_con *con, uint32_t cp)
+{
+	int last = con_lines - 1;
+
+	if (cp == '\n') {
+		con->nl = true;
+		return;
+	}
+	if (con->nl) {
+		// scroll up only once there is something for the new line
+		memmove(con->text[0], con->text[1], last * sizeof(con->text[0]));
+		lcd_con_blank(con->text[last], LCD_MAX_COLS);
+		con->col = 0;
+		con->nl = false;
+		con->msgs++;
+	}
+	if (con->col < lcd.map->cols)
+		con->text[last][con->col++] = cp;
+}
+
+// decoded as writes are, a message is text like any other
+static void lcd_con_byte(struct lcd_con *con, uint8_t c)
+{
+	uint32_t cp[4];
+	int got, k;
+
+	if (!lcd.charset) {
+		lcd_con_put(con, c);
+		return;
+	}
+	got = lcd_utf8_feed(&con->utf8, c, cp);
+	for (k = 0; k < got; k++)
+		lcd_con_put(con, cp[k]);
+}
+
+// the console is extended so each write is a whole record
+//   facility << 3 | level,seq,ts,flags;text\n
+// with anything past the text's \n its dictionary, and the text's bytes other
+// than printable ascii escaped as \xNN. Returns where the text starts and
+// sets level, or s when there is no header
+static const char *lcd_con_header(const char *s, const char *end, int *level)
+{
+	const char *p = s;
+	int v = 0;
+
+	while (p < end && *p >= '0' && *p <= '9')
+		v = v * 10 + *p++ - '0';
+	if (p == s || p == end || *p != ',')
+		return s;
+	p = memchr(p, ';', end - p);
+	if (!p)
+		return s;
+	*level = v & 7;
+	return p + 1;
+}
+
+static void lcd_con_write(struct console *co, const char *s, unsigned int n)
+{
+	struct lcd_con *con = &lcd_con;
+	const char *end = s + n;
+	unsigned long flags;
+	int level = 0;
+	uint8_t c;
+
+	// less urgent messages never touch the lcd
+	s = lcd_con_header(s, end, &level);
+	if (level > con_level)
+		return;
+
+	spin_lock_irqsave(&con->lock, flags);
+	for (; s < end; s++) {
+		if (*s == '\n') {
+			lcd_con_put(con, '\n');
+			break;
+		}
+		if (*s == '\\' && end - s >= 4 && s[1] == 'x' && !hex2bin(&c, s + 2, 1)) {
+			lcd_con_byte(con, c);
+			s += 3;
+			continue;
+		}
+		lcd_con_byte(con, *s);
+	}
+	if (!con->queued) {
+		con->queued = true;
+		schedule_delayed_work(&con_work, msecs_to_jiffies(con_rate));
+	}
+	spin_unlock_irqrestore(&con->lock, flags);
+}
+
+// the code a message's cp is put as, controls and the lcd's own codes (which a
+// message can't mean) are fill
+static uint8_t lcd_msg_code(struct lcd_t *lcd, uint32_t cp, uint8_t fill)
+{
+	if (cp < 0x20 || cp == 0x7f || (cp & ~0xff) == LCD_CP_ROM(0))
+		return fill;
+	if (cp >= 0x80 && !lcd->charset)
+		return fill;
+	return lcd_charset_code(lcd->charset, cp);
+}
+
+static long lcd_con_draw(struct lcd_t *lcd, void *data)
+{
+	uint32_t (*text)[LCD_MAX_COLS] = data;
+	int first = lcd->map->lines - con_lines;
+	int pos = lcd->pos;
+	int x, y;
+
+	for (y = 0; y < con_lines; y++) {
+		lcd_set_dram_addr(lcd, lcd->map->geo->start[first + y]);
+		for (x = 0; x < lcd->map->cols; x++)
+			lcd_putchar(lcd, lcd_msg_code(lcd, text[y][x], ' '));
+	}
+
+	// put the cursor back for whoever is writing to the rest
+	lcd_set_dram_addr(lcd, pos);
+	lcd_queue_flush(lcd);
+	return 0;
+}
+
+static void lcd_con_work(struct work_struct *work)
+{
+	uint32_t text[LCD_MAX_LINES][LCD_MAX_COLS];
+	unsigned long flags;
+
+	spin_lock_irqsave(&lcd_con.lock, flags);
+	memcpy(text, lcd_con.text, sizeof(text));
+	lcd_con.queued = false;
+	lcd_con.redraws++;
+	spin_unlock_irqrestore(&lcd_con.lock, flags);
+
+	lcd_pm_get(&lcd);
+	lcd_engine_run(lcd_con_draw, text);
+	lcd_pm_put(&lcd);
+}
+
+static struct console lcd_console = {
+	.name = "lcd",
+	.write = lcd_con_write,
+	.flags = CON_PRINTBUFFER | CON_EXTENDED,
+	.index = -1,
+};
+
+static void lcd_con_register(void)
+{
+	if (con_lines <= 0)
+		return;
+	if (con_lines > lcd.map->lines)
+		con_lines = lcd.map->lines;
+	lcd_con_blank(lcd_con.text[0], LCD_MAX_LINES * LCD_MAX_COLS);
+	register_console(&lcd_console);
+}
+
+static void lcd_con_unregister(void)
+{
+	if (con_lines <= 0)
+		return;
+	unregister_console(&lcd_console);
+	cancel_delayed_work_sync(&con_work);
+}
+
+// every open of the device is a writer with its own cursor and escape state,
+// swapped in for its bus work. Writers share the bus by weight: before each
+// piece of a write the waiting writer that has used the least bus time (over
+// its weight) goes next, and while others are waiting a write only gets
+// write_slice bytes at a time, so one streaming text can't keep the rest off
+#define LCD_WEIGHT_DEFAULT (100)
+#define LCD_WEIGHT_MAX     (10000)
+
+struct lcd_writer {
+	struct list_head node;
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	unsigned int weight;
+	u64 vtime;		// bus ns used, scaled by the default weight over ours
+	bool waiting;
+
+	// the engine state that is the writer's own (pos -1 to take the lcd's)
+	int pos;
+	enum write_state wstate;
+	struct lcd_utf8 utf8;
+	bool am;
+
+	// accounting
+	unsigned long writes;
+	unsigned long waits;	// pieces that had to wait for another writer
+	u64 bytes;
+	u64 cmds;
+	u64 bus_ns;
+};
+
+static struct lcd_sched {
+	spinlock_t lock;	// the writers and their accounting
+	wait_queue_head_t wq;
+	struct list_head writers;
+	struct lcd_writer *running;
+	u64 vclock;		// vtime of the last writer to go
+} lcd_sched = {
+	.lock = __SPIN_LOCK_UNLOCKED(lcd_sched.lock),
+	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(lcd_sched.wq),
+	.writers = LIST_HEAD_INIT(lcd_sched.writers),
+};
+
+// the waiting writer to go next, with the lock held
+static struct lcd_writer *lcd_sched_next(void)
+{
+	struct lcd_writer *w, *next = NULL;
+
+	list_for_each_entry(w, &lcd_sched.writers, node)
+		if (w->waiting && (!next || w->vtime < next->vtime))
+			next = w;
+	return next;
+}
+
+static bool lcd_sched_turn(struct lcd_writer *w)
+{
+	bool turn;
+
+	spin_lock(&lcd_sched.lock);
+	turn = !lcd_sched.running && lcd_sched_next() == w;
+	if (turn) {
+		lcd_sched.running = w;
+		lcd_sched.vclock = max(lcd_sched.vclock, w->vtime);
+	}
+	spin_unlock(&lcd_sched.lock);
+	return turn;
+}
+
+// wait for w's turn on the bus, returns whether other writers are waiting
+// (so the piece should be a slice) or -ERESTARTSYS
+static int lcd_sched_begin(struct lcd_writer *w)
+{
+	bool contended;
+	int ret;
+
+	// a writer back from idle starts level with the others rather than
+	// cashing in the time it didn't use
+	spin_lock(&lcd_sched.lock);
+	w->waiting = true;
+	w->vtime = max(w->vtime, lcd_sched.vclock);
+	contended = lcd_sched.running || lcd_sched_next() != w;
+	spin_unlock(&lcd_sched.lock);
+
+	ret = wait_event_interruptible(lcd_sched.wq, lcd_sched_turn(w));
+	spin_lock(&lcd_sched.lock);
+	w->waiting = false;
+	if (contended)
+		w->waits++;
+	if (!ret)
+		contended = lcd_sched_next() != NULL;
+	spin_unlock(&lcd_sched.lock);
+	if (ret) {
+		// someone else may be next now
+		wake_up_all(&lcd_sched.wq);
+		return ret;
+	}
+	return contended;
+}
+
+static void lcd_sched_charge(struct lcd_writer *w, u64 ns)
+{
+	w->bus_ns += ns;
+	w->vtime += div_u64(ns * LCD_WEIGHT_DEFAULT, w->weight);
+}
+
+static void lcd_sched_end(void)
+{
+	spin_lock(&lcd_sched.lock);
+	lcd_sched.running = NULL;
+	spin_unlock(&lcd_sched.lock);
+	wake_up_all(&lcd_sched.wq);
+}
+
+struct lcd_writer_call {
+	struct lcd_writer *w;
+	long (*fn)(struct lcd_t *lcd, void *data);
+	void *data;
+};
+
+static long lcd_engine_writer(struct lcd_t *lcd, void *data)
+{
+	struct lcd_writer_call *call = data;
+	struct lcd_writer *w = call->w;
+	unsigned long cmds = lcd->cmds;
+	ktime_t start = ktime_get();
+	long ret;
+
+	// pick up where this writer left off
+	if (w->pos < 0) {
+		w->pos = lcd->pos;
+		w->wstate = WRITE_STATE_NORMAL;
+		w->am = lcd->am;
+	}
+	lcd->wstate = w->wstate;
+	lcd->utf8 = w->utf8;
+	lcd->am = w->am;
+	if (lcd->pos != w->pos)
+		lcd_set_dram_addr(lcd, w->pos);
+
+	ret = call->fn(lcd, call->data);
+
+	w->pos = lcd->pos;
+	w->wstate = lcd->wstate;
+	w->utf8 = lcd->utf8;
+	w->am = lcd->am;
+	spin_lock(&lcd_sched.lock);
+	w->cmds += lcd->cmds - cmds;
+	lcd_sched_charge(w, ktime_to_ns(ktime_sub(ktime_get(), start)));
+	spin_unlock(&lcd_sched.lock);
+	return ret;
+}
+
+// run fn on the engine as writer w, see lcd_engine_run()
+static long lcd_writer_run(struct lcd_writer *w, long (*fn)(struct lcd_t *lcd, void *data), void *data)
+{
+	struct lcd_writer_call call = {.w = w, .fn = fn, .data = data};
+
+	return lcd_engine_run(lcd_engine_writer, &call);
+}
+
+struct lcd_seek {
+	loff_t off;
+	int whence;
+};
+
+static long lcd_engine_seek(struct lcd_t *lcd, void *data)
+{
+	struct lcd_seek *seek = data;
+	loff_t off = seek->off;
+
+	switch (seek->whence) {
+		case 0: // SEEK_SET
+			if (off > lcd->map->cells || off < 0) {
+				printk(KERN_ERR "unsupported SEEK_SET offset %llx\n", off);
+				return -EINVAL;
+			}
+			lcd_gotoxy(lcd, off, 0, WHENCE_ABS);
+			break;
+		case 1: // SEEK_CUR
+			if (off > lcd->map->cells || off < -lcd->map->cells) {
+				printk(KERN_ERR "unsupported SEEK_CUR offset %llx\n", off);
+				return -EINVAL;
+			}
+			lcd_gotoxy(lcd, off, 0, WHENCE_REL);
+			break;
+		case 2: // SEEK_END (not supported, hence fall though)
+		default:
+			// how did we get here !
+			printk(KERN_ERR "unsupported seek operation\n");
+			return -EINVAL;
+	}
+	lcd_queue_flush(lcd);
+	lcd->last_write = jiffies;
+	return lcd->pos;
+}
+
+loff_t lcd_llseek(struct file *filp, loff_t off, int whence)
+{
+	struct lcd_seek seek = {.off = off, .whence = whence};
+	loff_t ret;
+
+	lcd_pm_get(&lcd);
+	ret = lcd_writer_run(filp->private_data, lcd_engine_seek, &seek);
+	lcd_pm_put(&lcd);
+	if (ret >= 0)
+		filp->f_pos = ret;
+	return ret;
+}
+
+// put a utf-8 sequence the text stopped in the middle of as its bytes, so a
+// rom char such as a00's 0xdf at the end of a write shows up right away
+static void lcd_utf8_flush(struct lcd_t *lcd)
+{
+	int k;
+
+	for (k = 0; k < lcd->utf8.len; k++)
+		lcd_putchar(lcd, lcd_charset_code(lcd->charset, LCD_CP_ROM(lcd->utf8.raw[k])));
+	lcd->utf8.len = 0;
+}
+
+// print count bytes of buf, end is whether the text ends here (rather than
+// going on in the next piece of a sliced write)
+static ssize_t lcd_print_text(const char *buf, size_t count, bool end)
+{
+	ssize_t ret;
+
+	if (!frame) {
+		ret = lcd_puts(&lcd, buf, count);
+		if (end)
+			lcd_utf8_flush(&lcd);
+		lcd_queue_flush(&lcd);
+		return ret;
+	}
+
+	// let the engine draw into the frame, then send only what changed
+	lcd_frame_begin(&lcd);
+	ret = lcd_puts(&lcd, buf, count);
+	if (end)
+		lcd_utf8_flush(&lcd);
+	lcd_frame_end(&lcd, true);
+	lcd_queue_flush(&lcd);
+	return ret;
+}
+
+ssize_t lcd_print(const char *buf, size_t count)
+{
+	return lcd_print_text(buf, count, true);
+}
+
+ssize_t show_attr_corrupt(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%d\n", atomic_read(&corrupt));
+}
+
+ssize_t store_attr_corrupt(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	int _corrupt;
+
+	sscanf(buf, "%d", &_corrupt);
+	atomic_set(&corrupt, _corrupt);
+
+	return count;
+}
+
+static DEVICE_ATTR(corrupt, S_IWUGO | S_IRUGO, show_attr_corrupt, store_attr_corrupt);
+
+static long lcd_engine_busy_wait(struct lcd_t *lcd, void *data)
+{
+	return lcd_busy_wait(lcd);
+}
+
+ssize_t show_attr_busy(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	lcd_pm_get(&lcd);
+	lcd_engine_run(lcd_engine_busy_wait, NULL);
+	lcd_pm_put(&lcd);
+	return scnprintf(buf, PAGE_SIZE, "%d\n", atomic_read(&busy));
+}
+
+static DEVICE_ATTR(busy, S_IRUGO, show_attr_busy, NULL);
+
+ssize_t show_attr_busy_model(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	static const char *names[LCD_CMD_CLASSES] = {"home", "data", "addr", "ctrl"};
+	ssize_t n = 0;
+	int k;
+
+	for (k = 0; k < LCD_CMD_CLASSES; k++)
+		n += scnprintf(buf + n, PAGE_SIZE - n, "%s: est %uns hits %u polled %lu predicted %lu\n",
+			names[k], lcd.model[k].est, lcd.model[k].hits, lcd.model[k].polled, lcd.model[k].predicted);
+	return n;
+}
+
+static DEVICE_ATTR(busy_model, S_IRUGO, show_attr_busy_model, NULL);
+
+ssize_t show_attr_timing(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	const struct lcd_timing *t = &lcd.timing;
+
+	return scnprintf(buf, PAGE_SIZE, "%s tsp1 %d tpw %d tsp2 %d td %d tc %d tr %d tf %d tm %d tcap %d\n",
+		t->name, t->tsp1, t->tpw, t->tsp2, t->td, t->tc, t->tr, t->tf, t->tm, t->tcap);
+}
+
+ssize_t store_attr_timing(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	int ret;
+
+	mutex_lock(&lcd.lock);
+	ret = lcd_timing_select(&lcd, buf);
+	mutex_unlock(&lcd.lock);
+	if (ret < 0)
+		return ret;
+
+	return count;
+}
+
+static DEVICE_ATTR(timing, S_IWUSR | S_IRUGO, show_attr_timing, store_attr_timing);
+
+ssize_t show_attr_geometry(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%s\n", lcd_map.geo->name);
+}
+
+static DEVICE_ATTR(geometry, S_IRUGO, show_attr_geometry, NULL);
+
+ssize_t show_attr_scrub(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "checked %lu repairs %lu resyncs %lu\n",
+		lcd.scrub_checked, lcd.scrub_repairs, lcd.scrub_resyncs);
+}
+
+static DEVICE_ATTR(scrub, S_IRUGO, show_attr_scrub, NULL);
+
+ssize_t show_attr_queue(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	struct lcd_queue_stats q;
+
+	mutex_lock(&lcd.lock);
+	q = lcd.queue;
+	mutex_unlock(&lcd.lock);
+
+	return scnprintf(buf, PAGE_SIZE, "sent %lu dropped %lu merged %lu homes %lu moves %lu\n",
+		q.sent, q.dropped, q.merged, q.homes, q.moves);
+}
+
+ssize_t store_attr_queue(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	// any write resets the counters
+	mutex_lock(&lcd.lock);
+	memset(&lcd.queue, 0, sizeof(lcd.queue));
+	mutex_unlock(&lcd.lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(queue, S_IWUSR | S_IRUGO, show_attr_queue, store_attr_queue);
+
+ssize_t show_attr_plan(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	struct lcd_plan_stats p;
+
+	mutex_lock(&lcd.lock);
+	p = lcd.plan;
+	mutex_unlock(&lcd.lock);
+
+	return scnprintf(buf, PAGE_SIZE, "flushes %lu clears %lu data %lu fills %lu addrs %lu planned %lluus naive %lluus\n",
+		p.flushes, p.clears, p.data, p.fills, p.addrs, div_u64(p.planned_ns, 1000), div_u64(p.naive_ns, 1000));
+}
+
+ssize_t store_attr_plan(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	// any write resets the counters
+	mutex_lock(&lcd.lock);
+	memset(&lcd.plan, 0, sizeof(lcd.plan));
+	mutex_unlock(&lcd.lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(plan, S_IWUSR | S_IRUGO, show_attr_plan, store_attr_plan);
+
+ssize_t show_attr_recovery(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	struct lcd_recovery r;
+
+	mutex_lock(&lcd.lock);
+	r = lcd.recovery;
+	mutex_unlock(&lcd.lock);
+
+	return scnprintf(buf, PAGE_SIZE, "events %lu failed %lu busy_timeouts %lu strobes %lu total %lluus max %lluus\n",
+		r.events, r.failed, r.busy_timeouts, r.strobes, div_u64(r.ns, 1000), div_u64(r.max_ns, 1000));
+}
+
+ssize_t store_attr_recovery(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	// any write resets the counters
+	mutex_lock(&lcd.lock);
+	memset(&lcd.recovery, 0, sizeof(lcd.recovery));
+	mutex_unlock(&lcd.lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(recovery, S_IWUSR | S_IRUGO, show_attr_recovery, store_attr_recovery);
+
+ssize_t show_attr_pm(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%s %s resumes %lu last %lldus max %lldus\n",
+		lcd.suspended ? "suspended" : "active", power_down ? "power" : "display",
+		lcd.resumes, lcd.resume_last, lcd.resume_max);
+}
+
+static DEVICE_ATTR(pm, S_IRUGO, show_attr_pm, NULL);
+
+ssize_t show_attr_sim(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	struct lcd_sim *s;
+	char line[LCD_MAX_COLS + 1];
+	ssize_t n = 0;
+	int y, k;
+
+	if (!lcd.dio->sim[0])
+		return -ENODEV;
+
+	// a line of counters for each controller, then the screen
+	mutex_lock(&lcd.lock);
+	for (k = 0; k < LCD_CTRLS && lcd.dio->sim[k]; k++) {
+		s = lcd.dio->sim[k];
+		n += scnprintf(buf + n, PAGE_SIZE - n, "sets %lu gets %lu nibbles %lu cmds %lu data_writes %lu data_reads %lu status_reads %lu violations %lu\n",
+			s->sets, s->gets, s->nibbles, s->cmds, s->data_writes, s->data_reads, s->status_reads, s->violations);
+	}
+	for (y = 0; y < lcd.map->lines; y++) {
+		lcd_sim_line(lcd.dio, lcd.map, y, line);
+		n += scnprintf(buf + n, PAGE_SIZE - n, "|%s|\n", line);
+	}
+	mutex_unlock(&lcd.lock);
+
+	return n;
+}
+
+ssize_t store_attr_sim(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	int k;
+
+	if (!lcd.dio->sim[0])
+		return -ENODEV;
+
+	// any write resets the counters
+	mutex_lock(&lcd.lock);
+	for (k = 0; k < LCD_CTRLS && lcd.dio->sim[k]; k++)
+		lcd_sim_clear_stats(lcd.dio->sim[k]);
+	mutex_unlock(&lcd.lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(sim, S_IWUSR | S_IRUGO, show_attr_sim, store_attr_sim);
+
+// the codes of up to max cells of text s (len bytes), decoded as the parser
+// does when there is a charset (codes NULL just counts them), returns the
+// cells, everything that draws text on the lcd goes through here or the parser
+static int lcd_text_codes(const struct lcd_charset *cs, const char *s, size_t len, char *codes, int max)
+{
+	struct lcd_utf8 u = {0};
+	uint32_t cp[4];
+	size_t l;
+	int n = 0, got, k;
+
+	if (!cs) {
+		n = min_t(size_t, len, max);
+		if (codes)
+			memcpy(codes, s, n);
+		return n;
+	}
+
+	for (l = 0; l < len && n < max; l++) {
+		got = lcd_utf8_feed(&u, s[l], cp);
+		for (k = 0; k < got && n < max; k++, n++)
+			if (codes)
+				codes[n] = lcd_charset_code(cs, cp[k]);
+	}
+
+	// a sequence cut off by the end is its bytes
+	for (k = 0; k < u.len && n < max; k++, n++)
+		if (codes)
+			codes[n] = u.raw[k];
+	return n;
+}
+
+// named fields, each a fixed place on the lcd with a file of its own under
+// field/ that redraws just its cells when written (no open/seek/write and no
+// fight over the one open), defined through the fields attribute with
+//   name x y width [left|right|center] [printf style %s %d %u or %x]
+// and removed with -name
+#define LCD_FIELDS     (16)
+#define LCD_FIELD_NAME (16)
+#define LCD_FIELD_TEXT (4 * LCD_MAX_COLS + 1)	// utf-8 for a whole line
+
+#define LCD_TRIGGER_ARG (20)	// a thermal zone or netdev name
+
+struct lcd_trigger;
+
+enum lcd_align {LCD_ALIGN_LEFT, LCD_ALIGN_RIGHT, LCD_ALIGN_CENTER};
+static const char *lcd_align_names[] = {"left", "right", "center"};
+
+static struct lcd_field {
+	bool used;
+	bool removing;			// its file is on the way out
+	char name[LCD_FIELD_NAME];
+	int x, y, width;
+	enum lcd_align align;
+	char fmt[12];			// %s or a single validated number conversion
+	char text[LCD_FIELD_TEXT];	// as last drawn, before aligning
+	unsigned long seq;		// of its latest text
+	struct kobj_attribute attr;
+
+	const struct lcd_trigger *trig;	// keeps it up to date, if set
+	char trig_arg[LCD_TRIGGER_ARG];
+	u64 trig_count, trig_ns;	// the source's last sample, for rates
+} lcd_fields[LCD_FIELDS];
+
+static DEFINE_MUTEX(lcd_fields_lock);	// the table, never held over bus work
+static struct kobject *lcd_fields_kobj;
+static unsigned long lcd_fields_seq;	// numbers every text any field takes
+
+// a copy of what to draw, taken under the lock and drawn after dropping it
+struct lcd_field_draw {
+	struct lcd_field *f;
+	unsigned long seq;
+	int addr;
+	int width;
+	enum lcd_align align;
+	char text[LCD_FIELD_TEXT];
+};
+
+static long lcd_engine_field(struct lcd_t *lcd, void *data)
+{
+	struct lcd_field_draw *draw = data;
+	char codes[LCD_MAX_COLS], cells[LCD_MAX_COLS];
+	int pos = lcd->pos;
+	int k, n, pad;
+
+	// a newer text got in since the copy, its own draw comes after this
+	// one so drawing this would only be undone
+	if (READ_ONCE(draw->f->seq) != draw->seq)
+		return 0;
+
+	// aligned by the cells its text takes, not its bytes
+	n = lcd_text_codes(lcd->charset, draw->text, strlen(draw->text), codes, draw->width);
+	pad = draw->width - n;
+	if (draw->align == LCD_ALIGN_LEFT)
+		pad = 0;
+	else if (draw->align == LCD_ALIGN_CENTER)
+		pad /= 2;
+	memset(cells, ' ', draw->width);
+	memcpy(cells + pad, codes, n);
+
+	// through the frame so only the cells that changed are sent
+	lcd_frame_begin(lcd);
+	lcd_set_dram_addr(lcd, draw->addr);
+	for (k = 0; k < draw->width; k++)
+		lcd_putchar(lcd, cells[k]);
+	lcd_frame_end(lcd, false);
+
+	lcd_set_dram_addr(lcd, pos);
+	lcd_queue_flush(lcd);
+	lcd->last_write = jiffies;
+	return 0;
+}
+
+// %[0][width](s|d|u|x), anything else could take the wrong argument
+static bool lcd_field_fmt_ok(const char *fmt)
+{
+	if (*fmt++ != '%')
+		return false;
+	if (*fmt == '0')
+		fmt++;
+	while (*fmt >= '0' && *fmt <= '9')
+		fmt++;
+	return fmt[0] && strchr("sdux", fmt[0]) && !fmt[1];
+}
+
+// format value into text (which must hold LCD_FIELD_TEXT), it is aligned as
+// it is drawn
+static int lcd_field_format(struct lcd_field *f, const char *value, size_t count, char *text)
+{
+	char val[LCD_FIELD_TEXT];
+	char conv = f->fmt[strlen(f->fmt) - 1];	// s, d, u or x
+	long long n;
+	unsigned long long u;
+
+	count = min(count, sizeof(val) - 1);
+	memcpy(val, value, count);
+	val[count] = 0;
+	val[strcspn(val, "\n")] = 0;
+
+	if (conv == 's') {
+		scnprintf(text, LCD_FIELD_TEXT, f->fmt, val);
+	} else if (conv == 'd') {
+		if (kstrtoll(val, 0, &n))
+			return -EINVAL;
+		scnprintf(text, LCD_FIELD_TEXT, f->fmt, n);
+	} else {
+		if (kstrtoull(val, 0, &u))
+			return -EINVAL;
+		scnprintf(text, LCD_FIELD_TEXT, f->fmt, u);
+	}
+	return 0;
+}
+
+// take the field's new text (with the lock held), returns a copy to draw
+static void lcd_field_update(struct lcd_field *f, const char *text, struct lcd_field_draw *draw)
+{
+	strcpy(f->text, text);
+	WRITE_ONCE(f->seq, ++lcd_fields_seq);
+
+	draw->f = f;
+	draw->seq = f->seq;
+	draw->addr = lcd.map->geo->start[f->y] + f->x;
+	draw->width = f->width;
+	draw->align = f->align;
+	strcpy(draw->text, f->text);
+}
+
+// call without the lock held
+static void lcd_field_draw(struct lcd_field_draw *draw)
+{
+	lcd_pm_get(&lcd);
+	lcd_engine_run(lcd_engine_field, draw);
+	lcd_pm_put(&lcd);
+}
+
+// format value into the field, then draw it
+static int lcd_field_set(struct lcd_field *f, const char *value, size_t count)
+{
+	struct lcd_field_draw draw;
+	char text[LCD_FIELD_TEXT];
+	int ret;
+
+	mutex_lock(&lcd_fields_lock);
+	ret = f->used && !f->removing ? lcd_field_format(f, value, count, text) : -ENOENT;
+	if (!ret)
+		lcd_field_update(f, text, &draw);
+	mutex_unlock(&lcd_fields_lock);
+	if (ret)
+		return ret;
+
+	lcd_field_draw(&draw);
+	return 0;
+}
+
+static ssize_t show_field(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+	struct lcd_field *f = container_of(attr, struct lcd_field, attr);
+
+	return scnprintf(buf, PAGE_SIZE, "%s\n", f->text);
+}
+
+static ssize_t store_field(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	struct lcd_field *f = container_of(attr, struct lcd_field, attr);
+	int ret;
+
+	ret = lcd_field_set(f, buf, count);
+	return ret < 0 ? ret : count;
+}
+
+static struct lcd_field *lcd_field_find(const char *name)
+{
+	int k;
+
+	for (k = 0; k < LCD_FIELDS; k++)
+		if (lcd_fields[k].used && !strcmp(lcd_fields[k].name, name))
+			return &lcd_fields[k];
+	return NULL;
+}
+
+static int lcd_field_remove(const char *name)
+{
+	struct lcd_field *f;
+
+	mutex_lock(&lcd_fields_lock);
+	f = lcd_field_find(name);
+	if (!f || f->removing) {
+		mutex_unlock(&lcd_fields_lock);
+		return -ENOENT;
+	}
+	f->removing = true;
+	mutex_unlock(&lcd_fields_lock);
+
+	// removing the file waits for stores to it, which take the lock
+	if (lcd_fields_kobj)
+		sysfs_remove_file(lcd_fields_kobj, &f->attr.attr);
+
+	mutex_lock(&lcd_fields_lock);
+	f->used = false;
+	f->removing = false;
+	mutex_unlock(&lcd_fields_lock);
+	return 0;
+}
+
+static int lcd_field_define(const char *spec)
+{
+	char name[LCD_FIELD_NAME], align[8] = "left", fmt[8] = "%s";
+	struct lcd_field *f = NULL;
+	int x, y, width, n, k, ret = 0;
+
+	n = sscanf(spec, "%15s %d %d %d %7s %7s", name, &x, &y, &width, align, fmt);
+	if (n < 4 || strchr(name, '/') || name[0] == '.')
+		return -EINVAL;
+	if (y < 0 || y >= lcd.map->lines || x < 0 || width < 1 || x + width > lcd.map->cols)
+		return -EINVAL;
+	if (!lcd_field_fmt_ok(fmt))
+		return -EINVAL;
+
+	mutex_lock(&lcd_fields_lock);
+	if (lcd_field_find(name)) {
+		ret = -EEXIST;
+		goto exit;
+	}
+	for (k = 0; k < LCD_FIELDS && !f; k++)
+		if (!lcd_fields[k].used)
+			f = &lcd_fields[k];
+	if (!f) {
+		ret = -ENOSPC;
+		goto exit;
+	}
+	for (k = 0; k < ARRAY_SIZE(lcd_align_names); k++)
+		if (!strcmp(align, lcd_align_names[k]))
+			break;
+	if (k == ARRAY_SIZE(lcd_align_names)) {
+		ret = -EINVAL;
+		goto exit;
+	}
+
+	memset(f, 0, sizeof(*f));
+	strcpy(f->name, name);
+	f->x = x;
+	f->y = y;
+	f->width = width;
+	f->align = k;
+	// the number conversions are handed a long long
+	n = strlen(fmt) - 1;
+	if (fmt[n] == 's')
+		strcpy(f->fmt, fmt);
+	else
+		snprintf(f->fmt, sizeof(f->fmt), "%.*sll%c", n, fmt, fmt[n]);
+
+	sysfs_attr_init(&f->attr.attr);
+	f->attr.attr.name = f->name;
+	f->attr.attr.mode = S_IWUSR | S_IRUGO;
+	f->attr.show = show_field;
+	f->attr.store = store_field;
+	if (lcd_fields_kobj) {
+		ret = sysfs_create_file(lcd_fields_kobj, &f->attr.attr);
+		if (ret)
+			goto exit;
+	}
+	f->used = true;
+
+exit:
+	mutex_unlock(&lcd_fields_lock);
+	return ret;
+}
+
+ssize_t show_attr_fields(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	struct lcd_field *f;
+	ssize_t n = 0;
+
+	mutex_lock(&lcd_fields_lock);
+	for (f = lcd_fields; f < lcd_fields + LCD_FIELDS; f++)
+		if (f->used)
+			n += scnprintf(buf + n, PAGE_SIZE - n, "%s %d %d %d %s %s\n",
+				f->name, f->x, f->y, f->width, lcd_align_names[f->align], f->fmt);
+	mutex_unlock(&lcd_fields_lock);
+	return n;
+}
+
+ssize_t store_attr_fields(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	char name[LCD_FIELD_NAME];
+	int ret;
+
+	if (buf[0] == '-') {
+		if (sscanf(buf + 1, "%15s", name) != 1)
+			return -EINVAL;
+		ret = lcd_field_remove(name);
+	} else {
+		ret = lcd_field_define(buf);
+	}
+	return ret < 0 ? ret : count;
+}
+
+// drop every field and the field/ directory
+static void lcd_fields_remove(void)
+{
+	int k;
+
+	for (k = 0; k < LCD_FIELDS; k++)
+		if (lcd_fields[k].used)
+			lcd_field_remove(lcd_fields[k].name);
+	if (lcd_fields_kobj)
+		kobject_put(lcd_fields_kobj);
+	lcd_fields_kobj = NULL;
+}
+
+static DEVICE_ATTR(fields, S_IWUSR | S_IRUGO, show_attr_fields, store_attr_fields);
+
+// triggers keep a field up to date from a source in the kernel, much like
+// the led triggers, so nothing in userspace has to wake up to do it, bound
+// with "name source [arg]" to the triggers attribute ("name none" unbinds)
+//   cpu     % of all the cpus' time spent busy
+//   temp    thermal zone arg, degrees C
+//   rx tx   netdev arg, bytes/s
+//   link    netdev arg, up or down (text)
+//   uptime  days hours:minutes (text)
+// the bound fields are refreshed every trigger_rate ms from deferrable work
+// (so an idle cpu isn't woken for it) and only touch the lcd when they change
+struct lcd_trigger {
+	const char *name;
+	bool arg;
+	int (*render)(struct lcd_field *f, char *buf, size_t len);
+};
+
+static void lcd_trigger_work(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(trigger_work, lcd_trigger_work);
+
+// count's rate (per scale ns) since the last sample, none the first time
+static int lcd_trigger_rate(struct lcd_field *f, u64 count, u64 scale, u64 *rate)
+{
+	u64 now = ktime_to_ns(ktime_get_boottime());
+	u64 dcount = count - f->trig_count;
+	u64 dt = now - f->trig_ns;
+	bool first = !f->trig_ns;
+
+	f->trig_count = count;
+	f->trig_ns = now;
+	if (first || !dt)
+		return -EAGAIN;
+	*rate = div64_u64(dcount * scale, dt);
+	return 0;
+}
+
+static int lcd_trigger_cpu(struct lcd_field *f, char *buf, size_t len)
+{
+	u64 busy = 0, rate;
+	int cpu;
+
+	// as the led activity trigger, the busy time over all the cpus
+	for_each_possible_cpu(cpu) {
+		u64 *stat = kcpustat_cpu(cpu).cpustat;
+
+		busy += lcd_cputime_ns(stat[CPUTIME_USER]) + lcd_cputime_ns(stat[CPUTIME_NICE]) +
+			lcd_cputime_ns(stat[CPUTIME_SYSTEM]) + lcd_cputime_ns(stat[CPUTIME_SOFTIRQ]) +
+			lcd_cputime_ns(stat[CPUTIME_IRQ]);
+	}
+	if (lcd_trigger_rate(f, busy, 100, &rate))
+		return -EAGAIN;
+	return scnprintf(buf, len, "%llu", min(div_u64(rate, num_possible_cpus()), 100ULL));
+}
+
+static int lcd_trigger_temp(struct lcd_field *f, char *buf, size_t len)
+{
+	struct thermal_zone_device *tz = thermal_zone_get_zone_by_name(f->trig_arg);
+	lcd_temp_t temp;
+
+	if (IS_ERR(tz) || thermal_zone_get_temp(tz, &temp))
+		return -ENODEV;
+	return scnprintf(buf, len, "%d", (int)temp / 1000);
+}
+
+static int lcd_trigger_netdev(struct lcd_field *f, bool tx, char *buf, size_t len)
+{
+	struct rtnl_link_stats64 stats;
+	struct net_device *dev = dev_get_by_name(&init_net, f->trig_arg);
+	u64 rate;
+
+	if (!dev)
+		return -ENODEV;
+	dev_get_stats(dev, &stats);
+	dev_put(dev);
+	if (lcd_trigger_rate(f, tx ? stats.tx_bytes : stats.rx_bytes, NSEC_PER_SEC, &rate))
+		return -EAGAIN;
+	return scnprintf(buf, len, "%llu", rate);
+}
+
+static int lcd_trigger_rx(struct lcd_field *f, char *buf, size_t len)
+{
+	return lcd_trigger_netdev(f, false, buf, len);
+}
+
+static int lcd_trigger_tx(struct lcd_field *f, char *buf, size_t len)
+{
+	return lcd_trigger_netdev(f, true, buf, len);
+}
+
+static int lcd_trigger_link(struct lcd_field *f, char *buf, size_t len)
+{
+	struct net_device *dev = dev_get_by_name(&init_net, f->trig_arg);
+	bool up;
+
+	if (!dev)
+		return -ENODEV;
+	up = netif_running(dev) && netif_carrier_ok(dev);
+	dev_put(dev);
+	return scnprintf(buf, len, "%s", up ? "up" : "down");
+}
+
+static int lcd_trigger_uptime(struct lcd_field *f, char *buf, size_t len)
+{
+	unsigned long mins = (unsigned long)div_u64(ktime_to_ns(ktime_get_boottime()), NSEC_PER_SEC) / 60;
+
+	return scnprintf(buf, len, "%lud %02lu:%02lu", mins / (24 * 60), mins / 60 % 24, mins % 60);
+}
+
+static const struct lcd_trigger lcd_triggers[] = {
+	{"cpu",    false, lcd_trigger_cpu},
+	{"temp",   true,  lcd_trigger_temp},
+	{"rx",     true,  lcd_trigger_rx},
+	{"tx",     true,  lcd_trigger_tx},
+	{"link",   true,  lcd_trigger_link},
+	{"uptime", false, lcd_trigger_uptime},
+};
+
+static void lcd_trigger_work(struct work_struct *work)
 {
-	uint8_t db = 0x02;	// home 
+	static struct lcd_field_draw draws[LCD_FIELDS];	// the work never runs twice at once
+	char out[LCD_FIELD_TEXT], text[LCD_FIELD_TEXT];
+	struct lcd_field *f;
+	bool bound = false;
+	int k, n = 0;
+
+	mutex_lock(&lcd_fields_lock);
+	for (f = lcd_fields; f < lcd_fields + LCD_FIELDS; f++) {
+		if (!f->used || f->removing || !f->trig)
+			continue;
+		bound = true;
+		if (f->trig->render(f, out, sizeof(out)) < 0)
+			continue;
+
+		// nothing goes near the bus (or wakes the lcd) unless it changed,
+		// a text source on a number field never draws
+		if (lcd_field_format(f, out, strlen(out), text) || !strcmp(text, f->text))
+			continue;
+		lcd_field_update(f, text, &draws[n++]);
+	}
+	if (bound)
+		schedule_delayed_work(&trigger_work, msecs_to_jiffies(trigger_rate > 0 ? trigger_rate : 1000));
+	mutex_unlock(&lcd_fields_lock);
 
-	// wait for the lcd to be ready before sending the command
-	lcd_busy_wait(lcd);
-	lcd_write8(lcd, 0, db);
-	lcd->pos = 0;
+	for (k = 0; k < n; k++)
+		lcd_field_draw(&draws[k]);
 }
 
-static void lcd_entry_mode(struct lcd_t *lcd, enum lcd_id id, enum lcd_sh sh)
+static int lcd_trigger_bind(const char *name, const char *source, const char *arg)
 {
-	uint8_t db = 0x04;	// entry mode
+	const struct lcd_trigger *trig = NULL;
+	struct lcd_field *f;
+	int k, ret = 0;
+
+	for (k = 0; k < ARRAY_SIZE(lcd_triggers); k++)
+		if (!strcmp(source, lcd_triggers[k].name))
+			trig = &lcd_triggers[k];
+	if (!trig && strcmp(source, "none"))
+		return -EINVAL;
+	if (trig && trig->arg && !arg[0])
+		return -EINVAL;
+
+	mutex_lock(&lcd_fields_lock);
+	f = lcd_field_find(name);
+	if (!f || f->removing) {
+		ret = -ENOENT;
+		goto exit;
+	}
+	f->trig = trig;
+	strcpy(f->trig_arg, arg);
+	f->trig_count = 0;
+	f->trig_ns = 0;
 
-	// build command
-	db |= id | sh;
+	// take the first sample now
+	if (trig)
+		schedule_delayed_work(&trigger_work, 0);
 
-	// wait for the lcd to be ready before sending the command
-	lcd_busy_wait(lcd);
-	lcd_write8(lcd, 0, db);
+exit:
+	mutex_unlock(&lcd_fields_lock);
+	return ret;
 }
 
-static void lcd_set_dram_addr(struct lcd_t *lcd, uint8_t addr)
+ssize_t show_attr_triggers(struct device *dev, struct device_attribute * attr, char *buf)
 {
-	uint8_t db = 0x80;	// set dram address 
+	struct lcd_field *f;
+	ssize_t n = 0;
+
+	mutex_lock(&lcd_fields_lock);
+	for (f = lcd_fields; f < lcd_fields + LCD_FIELDS; f++)
+		if (f->used && f->trig)
+			n += scnprintf(buf + n, PAGE_SIZE - n, "%s %s %s\n", f->name, f->trig->name, f->trig_arg);
+	mutex_unlock(&lcd_fields_lock);
+	return n;
+}
 
-	// build command
-	addr &= 0x7f;
-	db |= addr;
+ssize_t store_attr_triggers(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	char name[LCD_FIELD_NAME], source[8], arg[LCD_TRIGGER_ARG] = "";
+	int ret;
 
-	// wait for the lcd to be ready before sending the command
-	lcd_busy_wait(lcd);
-	lcd_write8(lcd, 0, db);
-	lcd->pos = addr;
+	if (sscanf(buf, "%15s %7s %19s", name, source, arg) < 2)
+		return -EINVAL;
+	ret = lcd_trigger_bind(name, source, arg);
+	return ret < 0 ? ret : count;
 }
 
-#define LINE1_EOLPP (0x20)
-#define LINE2_EOLPP (0x21)
-#define LINE3_EOLPP (0x60)
-#define LINE4_EOLPP (0x61)
-#define LINE1_SOLMM (0x67)
-#define LINE2_SOLMM (0x66)
-#define LINE3_SOLMM (0x27)
-#define LINE4_SOLMM (0x26)
-static void lcd_set_am(struct lcd_t *lcd, bool am)
-{
-	if (am && !lcd->am) {
-		// enable am when currently disabled
-		switch (lcd->pos) {
-			case LINE1_EOLPP:
-				lcd_set_dram_addr(lcd, LINE1_START + LINE_LENGTH - 1);
-				break;
-			case LINE2_EOLPP:
-				lcd_set_dram_addr(lcd, LINE2_START + LINE_LENGTH - 1);
-				break;
-			case LINE3_EOLPP:
-				lcd_set_dram_addr(lcd, LINE3_START + LINE_LENGTH - 1);
-				break;
-			case LINE4_EOLPP:
-				lcd_set_dram_addr(lcd, LINE4_START + LINE_LENGTH - 1);
-				break;
-			case LINE1_SOLMM:
-				lcd_set_dram_addr(lcd, LINE1_START);
-				break;
-			case LINE2_SOLMM:
-				lcd_set_dram_addr(lcd, LINE2_START);
-				break;
-			case LINE3_SOLMM:
-				lcd_set_dram_addr(lcd, LINE3_START);
-				break;
-			case LINE4_SOLMM:
-				lcd_set_dram_addr(lcd, LINE4_START);
-				break;
-			default:
-				break;
-		}
-	} else if (!am && lcd->am) {
-		// disable am (do nothing, we are already at a valid location
-		// and will just roll off the eol or sol naturally
-	}
-	
-	lcd->am = am;
-}
-
-static void lcd_inc_pos(struct lcd_t *lcd)
-{
-	if (lcd->am) {
-		// automatic margins (wrap to next line)
-		switch (++lcd->pos) {
-			case LINE1_START + LINE_LENGTH:
-				// end of line 1, goto line 2
-				lcd_set_dram_addr(lcd, LINE2_START);
-				break;
-			case LINE2_START + LINE_LENGTH:
-				// end of line 2, goto line 3
-				lcd_set_dram_addr(lcd, LINE3_START);
-				break;
-			case LINE3_START + LINE_LENGTH:
-				// end of line 3, goto line 4
-				lcd_set_dram_addr(lcd, LINE4_START);
-				break;
-			case LINE4_START + LINE_LENGTH:
-				// end of line 4, goto line 1
-				lcd_set_dram_addr(lcd, LINE1_START);
-				break;
-			default:
-				break;
-		}
-	} else {
-		// no automatic margins.
-		switch (lcd->pos) {
-			case LINE1_EOLPP:
-			case LINE2_EOLPP:
-			case LINE3_EOLPP:
-			case LINE4_EOLPP:
-			case LINE1_SOLMM:
-			case LINE2_SOLMM:
-			case LINE3_SOLMM:
-			case LINE4_SOLMM:
-				// stay put when am = false and we ran off a line
-				lcd_set_dram_addr(lcd, lcd->pos);
-				return;
-			default:
-				break;
-		}
-		switch (++lcd->pos) {
-			case LINE1_START + LINE_LENGTH:
-				// end of line 1, pin to eol
-				lcd_set_dram_addr(lcd, LINE1_EOLPP);
-				break;
-			case LINE2_START + LINE_LENGTH:
-				// end of line 2, pin to eol
-				lcd_set_dram_addr(lcd, LINE2_EOLPP);
-				break;
-			case LINE3_START + LINE_LENGTH:
-				// end of line 3, pin to eol
-				lcd_set_dram_addr(lcd, LINE3_EOLPP);
-				break;
-			case LINE4_START + LINE_LENGTH:
-				// end of line 4, pin to eol
-				lcd_set_dram_addr(lcd, LINE4_EOLPP);
-				break;
-			default:
-				break;
+static DEVICE_ATTR(triggers, S_IWUSR | S_IRUGO, show_attr_triggers, store_attr_triggers);
+
+// animations (see fls_lcd_ioctl.h) play from an hrtimer that hands each
+// frame to a work item, the frame goes through the frame path so a spinner
+// costs a char or two a frame and userspace nothing at all
+static struct lcd_anim_player {
+	struct mutex lock;		// held over a frame, and to start or stop
+	struct lcd_anim anim;
+	int step;
+	int loops;			// passes left, 0 forever
+	bool playing;
+	ktime_t next;			// when the next frame is due
+	struct hrtimer timer;
+	struct work_struct work;
+	unsigned long frames;
+	unsigned long late;		// frames drawn after the next was due
+} lcd_player;
+
+static void lcd_anim_work(struct work_struct *work);
+static struct lcd_anim_player lcd_player = {
+	.lock = __MUTEX_INITIALIZER(lcd_player.lock),
+	.work = __WORK_INITIALIZER(lcd_player.work, lcd_anim_work),
+};
+
+static long lcd_engine_anim(struct lcd_t *lcd, void *data)
+{
+	struct lcd_anim_player *player = data;
+	struct lcd_anim_step *step;
+	char codes[LCD_ANIM_TEXT];
+	int pos = lcd->pos;
+	int k, n, cell;
+
+	// a frame is its step plus any before it with no time of their own
+	lcd_frame_begin(lcd);
+	do {
+		step = &player->anim.step[player->step++];
+		n = lcd_text_codes(lcd->charset, step->text, step->len, codes, LCD_ANIM_TEXT);
+		for (k = 0; k < n; k++) {
+			cell = step->cell + k;
+			if (k == 0 || cell % lcd->map->cols == 0)
+				lcd_set_dram_addr(lcd, lcd->map->addr[cell]);
+			lcd_putchar(lcd, codes[k]);
 		}
-	}
+	} while (!step->ms && player->step < player->anim.steps);
+	lcd_frame_end(lcd, false);
+
+	lcd_set_dram_addr(lcd, pos);
+	lcd_queue_flush(lcd);
+	lcd->last_write = jiffies;
+	return step->ms;
 }
 
-static void lcd_dec_pos(struct lcd_t *lcd)
-{
-	if (lcd->am) {
-		switch (--lcd->pos) {
-			case LINE1_START - 1:
-				// start of line 1, goto line 4
-				lcd_set_dram_addr(lcd, LINE4_START + LINE_LENGTH - 1);
-				break;
-			case LINE2_START - 1:
-				// start of line 2, goto line 1
-				lcd_set_dram_addr(lcd, LINE1_START + LINE_LENGTH - 1);
-				break;
-			case LINE3_START - 1:
-				// start of line 3, goto line 2
-				lcd_set_dram_addr(lcd, LINE2_START + LINE_LENGTH - 1);
-				break;
-			case LINE4_START - 1:
-				// start of line 4, goto line 3
-				lcd_set_dram_addr(lcd, LINE3_START + LINE_LENGTH - 1);
-				break;
-			default:
-				break;
-		}
-	} else {
-		// no automatic margins.
-		switch (lcd->pos) {
-			case LINE1_EOLPP:
-			case LINE2_EOLPP:
-			case LINE3_EOLPP:
-			case LINE4_EOLPP:
-			case LINE1_SOLMM:
-			case LINE2_SOLMM:
-			case LINE3_SOLMM:
-			case LINE4_SOLMM:
-				// stay put when am = false and we ran off a line
-				lcd_set_dram_addr(lcd, lcd->pos);
-				return;
-			default:
-				break;
-		}
-		switch (--lcd->pos) {
-			case LINE1_START - 1:
-				// start of line 1, pin to sol
-				lcd_set_dram_addr(lcd, LINE1_SOLMM);
-				break;
-			case LINE2_START - 1:
-				// start of line 2, pin to sol
-				lcd_set_dram_addr(lcd, LINE2_SOLMM);
-				break;
-			case LINE3_START - 1:
-				// start of line 3, pin to sol
-				lcd_set_dram_addr(lcd, LINE3_SOLMM);
-				break;
-			case LINE4_START - 1:
-				// start of line 4, pin to sol
-				lcd_set_dram_addr(lcd, LINE4_SOLMM);
-				break;
-			default:
-				break;
+static void lcd_anim_work(struct work_struct *work)
+{
+	struct lcd_anim_player *player = container_of(work, struct lcd_anim_player, work);
+	ktime_t now;
+	long ms;
+
+	mutex_lock(&player->lock);
+	if (!player->playing)
+		goto exit;
+
+	lcd_pm_get(&lcd);
+	ms = lcd_engine_run(lcd_engine_anim, player);
+	lcd_pm_put(&lcd);
+	player->frames++;
+
+	if (player->step == player->anim.steps) {
+		player->step = 0;
+		if (player->loops && !--player->loops) {
+			// the last frame stays up
+			player->playing = false;
+			goto exit;
 		}
 	}
+
+	// keep to the timeline rather than drift by however long each frame
+	// took, but a frame that is already late goes now rather than bunching
+	// up the ones after it
+	player->next = ktime_add_ns(player->next, ms * NSEC_PER_MSEC);
+	now = ktime_get();
+	if (ktime_to_ns(player->next) < ktime_to_ns(now)) {
+		player->late++;
+		player->next = now;
+	}
+	hrtimer_start(&player->timer, player->next, HRTIMER_MODE_ABS);
+
+exit:
+	mutex_unlock(&player->lock);
 }
 
-#define LINE_MASK (LINE1_START | LINE2_START | LINE3_START | LINE4_START)
-void lcd_getxy(struct lcd_t *lcd, int *x, int *y)
+static enum hrtimer_restart lcd_anim_timer(struct hrtimer *timer)
 {
-	bool am = lcd->am;
+	struct lcd_anim_player *player = container_of(timer, struct lcd_anim_player, timer);
 
-	lcd_set_am(lcd, true);
-	*x = lcd->pos & 0x0f;
-	switch (lcd->pos & LINE_MASK) {
-		case LINE1_START:
-			*y = 0;
-			break;
-		case LINE2_START:
-			*y = 1;
-			break;
-		case LINE3_START:
-			*y = 2;
-			break;
-		case LINE4_START:
-			*y = 3;
-			break;
-		default:
-			// how did we get here !!
-			*y = 0;
-			break;
-	}
-	lcd_set_am(lcd, am);
+	// no bus work from here, that sleeps
+	schedule_work(&player->work);
+	return HRTIMER_NORESTART;
 }
 
-enum whence_t {WHENCE_ABS, WHENCE_REL};
-int lcd_gotoxy(struct lcd_t *lcd, int x, int y, enum whence_t whence)
+// the timer can't be set up statically
+static void lcd_anim_init(void)
 {
-	int r = 0;
-	int dp;
-	bool am = lcd->am;
-
-	switch (whence) {
-		case WHENCE_ABS:
-			// bounds check x,y
-			if (y * LINE_LENGTH + x > 4 * LINE_LENGTH)
-				return -1;
-			lcd_home(lcd);
-			// now we are at 0 fall through to relative moves
+	lcd_hrtimer_setup(&lcd_player.timer, lcd_anim_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+}
 
-		case WHENCE_REL:
-			// x,y are not bounds check on relative moves (they just wrap)
-			dp = y * LINE_LENGTH + x;
-			if (dp < 0) {
-				lcd_set_am(lcd, true);
-				while (dp++ != 0)
-					lcd_dec_pos(lcd);
-				lcd_set_am(lcd, am);
-			}
-			else if (dp > 0) {
-				lcd_set_am(lcd, true);
-				while (dp-- != 0)
-					lcd_inc_pos(lcd);
-				lcd_set_am(lcd, am);
-			}
-			break;
-	}
+static void lcd_anim_stop(void)
+{
+	mutex_lock(&lcd_player.lock);
+	lcd_player.playing = false;
+	mutex_unlock(&lcd_player.lock);
 
-	lcd_set_dram_addr(lcd, lcd->pos);
-	return r;
+	// once it is not playing nothing starts the timer again
+	hrtimer_cancel(&lcd_player.timer);
+	cancel_work_sync(&lcd_player.work);
 }
 
-static char lcd_read_data(struct lcd_t *lcd, int addr)
+static int lcd_anim_play(const struct lcd_anim *anim)
 {
-	int ipos = lcd->pos;
-	char c;
-	
-	lcd_set_dram_addr(lcd, addr);
-	lcd_busy_wait(lcd);
-	c = (char)lcd_read8(lcd, 1);
-	lcd_set_dram_addr(lcd, ipos); // restore position when we entered
+	int k;
+
+	// the last step has to take some time or a loop would never let go
+	if (anim->steps < 1 || anim->steps > LCD_ANIM_STEPS || !anim->step[anim->steps - 1].ms)
+		return -EINVAL;
+	for (k = 0; k < anim->steps; k++)
+		if (anim->step[k].len > LCD_ANIM_TEXT || anim->step[k].cell +
+		    lcd_text_codes(lcd.charset, anim->step[k].text, anim->step[k].len, NULL, LCD_ANIM_TEXT) > lcd.map->cells)
+			return -EINVAL;
 
-	return c;
+	lcd_anim_stop();
+	mutex_lock(&lcd_player.lock);
+	lcd_player.anim = *anim;
+	lcd_player.step = 0;
+	lcd_player.loops = anim->loops;
+	lcd_player.playing = true;
+	lcd_player.next = ktime_get();
+	mutex_unlock(&lcd_player.lock);
+
+	schedule_work(&lcd_player.work);
+	return 0;
 }
 
-static void lcd_putchar(struct lcd_t *lcd, char c)
+ssize_t show_attr_anim(struct device *dev, struct device_attribute * attr, char *buf)
 {
-	int ipos = lcd->pos;
-	char rc;
-	int retries = 5;
+	ssize_t n;
+
+	mutex_lock(&lcd_player.lock);
+	n = scnprintf(buf, PAGE_SIZE, "playing %d steps %d step %d loops %d frames %lu late %lu\n",
+		lcd_player.playing, lcd_player.anim.steps, lcd_player.step, lcd_player.loops,
+		lcd_player.frames, lcd_player.late);
+	mutex_unlock(&lcd_player.lock);
+	return n;
+}
 
-	while (--retries) {
-		// wait for the lcd to be ready before sending the command
-		lcd_busy_wait(lcd);
-		lcd_write8(lcd, 1, c);
-		lcd_inc_pos(lcd);
-		
-		// check we wrote c to the screen (this is for debugging a
-		// problem where the lcd goes bananas)
-		rc = lcd_read_data(lcd, ipos);
-		if (rc == c)
-			return;
+ssize_t store_attr_anim(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	// any write resets the counters
+	mutex_lock(&lcd_player.lock);
+	lcd_player.frames = 0;
+	lcd_player.late = 0;
+	mutex_unlock(&lcd_player.lock);
 
-		// We failed to put the char we wanted, presumably this is the 
-		// nibble offset bug, so lets try to get back in sync, we also
-		// set the corrupt bit to let the sysfs know our lcd may need 
-		// redrawing (and emit a syslog error if this is the first 
-		// warning so we don't spam the logs)
-		if (!atomic_read(&corrupt)) // this is just a error message so the atomic race is not important here
-			printk(KERN_ERR "[ERR] wrote 0x%.2x and read 0x%.2x\n", c, rc);
-		atomic_set(&corrupt, 1);
-		lcd_write4(lcd, 1, 0); // hopefully this get the nibbles back in sync
-		// Reinitializing to return to a known state after corruption
-		lcd_set_dram_addr(lcd, ipos);
-		lcd_display_control(lcd, lcd->display_state, lcd->cursor_state, lcd->blink_state);
-		lcd_set_am(lcd, lcd->am);
-		lcd_busy_wait(lcd);
-	}
+	return count;
 }
 
-static void lcd_4bit_init(struct lcd_t *lcd, enum lcd_lines lines, enum lcd_font font)
+static DEVICE_ATTR(anim, S_IWUSR | S_IRUGO, show_attr_anim, store_attr_anim);
+
+// screen presets (see fls_lcd_ioctl.h), showing one draws it through the
+// frame so only the cells that differ from what is up go out, and never
+// with a clear as that flickers
+static struct lcd_presets {
+	struct mutex lock;		// held over a show, and to set one
+	char text[LCD_PRESETS][LCD_PRESET_TEXT];
+	DECLARE_BITMAP(defined, LCD_PRESETS);
+	unsigned long shows;
+	unsigned long cells;		// sent by shows
+} lcd_presets = {
+	.lock = __MUTEX_INITIALIZER(lcd_presets.lock),
+};
+
+static long lcd_engine_preset(struct lcd_t *lcd, void *data)
 {
-	// force us into 8 bit mode (just to get to a known sync point)
-	lcd_write4(lcd, 0, 0x30);
-	mdelay(Tpor1);
-	lcd_write4(lcd, 0, 0x30);
-	udelay(Tpor2);
-	lcd_write4(lcd, 0, 0x30);
-	udelay(Tpor3);
+	const char *text = data;
+	unsigned long sent = lcd->plan.data + lcd->plan.fills;
+	char codes[LCD_MAX_CELLS];
+	int pos = lcd->pos;
+	int cell, n;
+
+	// cells after the text are blank
+	n = lcd_text_codes(lcd->charset, text, strnlen(text, LCD_PRESET_TEXT), codes, lcd->map->cells);
+	memset(codes + n, ' ', lcd->map->cells - n);
+
+	lcd_frame_begin(lcd);
+	for (cell = 0; cell < lcd->map->cells; cell++) {
+		if (cell % lcd->map->cols == 0)
+			lcd_set_dram_addr(lcd, lcd->map->addr[cell]);
+		lcd_putchar(lcd, codes[cell]);
+	}
+	lcd_frame_end(lcd, false);
 
-	// goto 4 bit mode (setting the number of lines and font)
-	// note we are only able to run this function set at this stage and never again (see datasheet p16, and
-	// http://www.piclist.com/techref/postbot.asp?by=thread&id=HD44780+LCD+and+4-bit+mode+using+16F84&w=body&tgt=post)
-	lcd_write4(lcd, 0, 0x20);
-	udelay(Tpor4);
-	
-	// set initial startup settings recommended in the datasheet
-	lcd_function_set(lcd, lcd_lines_2, lcd_font_5by8);
-	lcd_display_control(lcd, lcd_display_off, lcd_cursor_off, lcd_blink_off); // turn everything off
-	lcd_entry_mode(lcd, lcd_id_right, lcd_sh_off);
+	lcd_set_dram_addr(lcd, pos);
+	lcd_queue_flush(lcd);
+	lcd->last_write = jiffies;
+	return lcd->plan.data + lcd->plan.fills - sent;
 }
 
-loff_t lcd_llseek(struct file *filp, loff_t off, int whence)
+static int lcd_preset_set(const struct lcd_preset *preset)
 {
-	switch (whence) {
-		case 0: // SEEK_SET
-			if (off > 4*LINE_LENGTH || off < 0) {
-				printk(KERN_ERR "unsupported SEEK_SET offset %llx\n", off);
-				return -EINVAL;
-			}
-			lcd_gotoxy(&lcd, off, 0, WHENCE_ABS);
-			break;
-		case 1: // SEEK_CUR
-			if (off > 4*LINE_LENGTH || off < -4*LINE_LENGTH) {
-				printk(KERN_ERR "unsupported SEEK_CUR offset %llx\n", off);
-				return -EINVAL;
-			}
-			lcd_gotoxy(&lcd, off, 0, WHENCE_REL);
-			break;
-		case 2: // SEEK_END (not supported, hence fall though)
-		default:
-			// how did we get here !
-			printk(KERN_ERR "unsupported seek operation\n");
-			return -EINVAL;
-	}
-	filp->f_pos = lcd.pos;
-	return lcd.pos;
+	int len;
+
+	if (preset->id >= LCD_PRESETS)
+		return -EINVAL;
+
+	// kept as text, it is decoded as it is shown
+	len = strnlen(preset->text, LCD_PRESET_TEXT);
+	mutex_lock(&lcd_presets.lock);
+	memcpy(lcd_presets.text[preset->id], preset->text, len);
+	memset(lcd_presets.text[preset->id] + len, 0, LCD_PRESET_TEXT - len);
+	set_bit(preset->id, lcd_presets.defined);
+	mutex_unlock(&lcd_presets.lock);
+	return 0;
 }
 
-ssize_t lcd_print(const char *buf, size_t count)
+static int lcd_preset_show(struct lcd_writer *w, unsigned int id)
 {
-	size_t l;
-	int x, y;
+	int ret = 0;
 
-	for (l = 0; l < count && buf[l] != 0; l++)
-	{
-		switch (lcd.wstate)
-		{
-			case WRITE_STATE_NORMAL:
-				switch(buf[l])
-				{
-					case 0x1b:
-						// escape char mode !
-						lcd.wstate = WRITE_STATE_ESCAPE1;
-						break;
-					case '\n':
-						// new line
-						lcd_gotoxy(&lcd, 0, 1, WHENCE_REL);
-						break;
-					case '\r':
-						// cr (goto x = 0)
-						lcd_getxy(&lcd, &x, &y);
-						lcd_gotoxy(&lcd, -x, 0, WHENCE_REL);
-						break;
-					case '\t':
-						// tab (align to 4 bytes)
-						do
-						{
-							lcd_putchar(&lcd, ' ');
-							lcd_getxy(&lcd, &x, &y);
-						}
-						while (x % 4 != 0);
-						break;
-					case '\b':
-						// backspace
-						lcd_gotoxy(&lcd, -1, 0, WHENCE_REL);
-						break;
-					default:
-						// normal characters
-						lcd_putchar(&lcd, buf[l]);
-						break;
-				}
-				break;
-
-			case WRITE_STATE_ESCAPE1:
-				switch(buf[l])
-				{
-					case 'a':
-						// all attributes off (blink = 0)
-						lcd_cursor(&lcd, 0);
-						lcd_blink(&lcd, 0);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'b':
-						// blink on
-						lcd_blink(&lcd, 1);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'v':
-						// cursor visible
-						lcd_cursor(&lcd, 1);
-						lcd_blink(&lcd, 0);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'V':
-						// cursor invisible
-						lcd_cursor(&lcd, 0);
-						lcd_blink(&lcd, 0);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'h':
-						// cursor high visible (cursor with block blink)
-						lcd_blink(&lcd, 1);
-						lcd_cursor(&lcd, 0);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'H':
-						// home cursor wtf does this mean (0,0 or sol)?
-						lcd_gotoxy(&lcd, 0, 0, WHENCE_ABS);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'J':
-						// clear screen and home the cursor
-						lcd_clear(&lcd);
-						lcd_gotoxy(&lcd, 0, 0, WHENCE_ABS);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'B':
-						// move down 1
-						lcd_gotoxy(&lcd, 0, 1, WHENCE_REL);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'A':
-						// move up 1
-						lcd_gotoxy(&lcd, 0, -1, WHENCE_REL);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'D':
-						// move left 1
-						lcd_gotoxy(&lcd, -1, 0, WHENCE_REL);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'C':
-						// move right 1
-						lcd_gotoxy(&lcd, 1, 0, WHENCE_REL);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'm':
-						lcd_set_am(&lcd, true);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					case 'M':
-						lcd_set_am(&lcd, false);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-					default:
-						// unknown escape code (just dump the output)
-						printk(KERN_WARNING "unknown escape code %.2x\n", buf[l]);
-						lcd.wstate = WRITE_STATE_NORMAL;
-						break;
-				}
-				break;
-		}
+	if (id >= LCD_PRESETS)
+		return -EINVAL;
+
+	mutex_lock(&lcd_presets.lock);
+	if (!test_bit(id, lcd_presets.defined)) {
+		ret = -ENOENT;
+		goto exit;
 	}
+	lcd_pm_get(&lcd);
+	lcd_presets.cells += lcd_writer_run(w, lcd_engine_preset, lcd_presets.text[id]);
+	lcd_pm_put(&lcd);
+	lcd_presets.shows++;
 
-	return l;
+exit:
+	mutex_unlock(&lcd_presets.lock);
+	return ret;
 }
 
-ssize_t show_attr_corrupt(struct device *dev, struct device_attribute * attr, char *buf)
+ssize_t show_attr_presets(struct device *dev, struct device_attribute * attr, char *buf)
 {
-	return scnprintf(buf, PAGE_SIZE, "%d\n", atomic_read(&corrupt));
+	int n, id;
+
+	mutex_lock(&lcd_presets.lock);
+	n = scnprintf(buf, PAGE_SIZE, "shows %lu cells %lu defined", lcd_presets.shows, lcd_presets.cells);
+	for_each_set_bit(id, lcd_presets.defined, LCD_PRESETS)
+		n += scnprintf(buf + n, PAGE_SIZE - n, " %d", id);
+	mutex_unlock(&lcd_presets.lock);
+	n += scnprintf(buf + n, PAGE_SIZE - n, "\n");
+	return n;
 }
 
-ssize_t store_attr_corrupt(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+static DEVICE_ATTR(presets, S_IRUGO, show_attr_presets, NULL);
+
+// glyphs for code points the rom doesn't have (or to draw in place of its
+// own), written as U+2665 0a1f1f1f0e040000 (a row of 5 dots a byte, top
+// first) into the next free cgram slot or the code point's own, or U+2665 on
+// its own to free the slot
+struct lcd_glyph_load {
+	uint32_t cp;
+	bool unload;
+	uint8_t rows[8];
+};
+
+// the slot is picked here, under the lock, so two loads can't both take the
+// same free one
+static long lcd_engine_glyph(struct lcd_t *lcd, void *data)
 {
-	int _corrupt;
+	struct lcd_glyph_load *load = data;
+	int k, slot = -1;
+
+	// the code point's own slot, or a free one for a new glyph
+	for (k = 0; k < LCD_GLYPHS && slot < 0; k++)
+		if (lcd_charset.glyph[k] == load->cp)
+			slot = k;
+	for (k = 0; k < LCD_GLYPHS && slot < 0 && !load->unload; k++)
+		if (!lcd_charset.glyph[k])
+			slot = k;
+	if (slot < 0)
+		return load->unload ? -ENOENT : -ENOSPC;
+
+	if (load->unload) {
+		lcd_charset.glyph[slot] = 0;
+	} else {
+		lcd_charset.glyph[slot] = load->cp;
+		memcpy(lcd_glyph_rows[slot], load->rows, sizeof(load->rows));
+		lcd_glyph_load(lcd, slot);
+		lcd_queue_flush(lcd);
+	}
+	lcd_charset_build(&lcd_charset, lcd_charset.rom);
+	return 0;
+}
 
-	sscanf(buf, "%d", &_corrupt);
-	atomic_set(&corrupt, _corrupt);
+ssize_t show_attr_glyphs(struct device *dev, struct device_attribute * attr, char *buf)
+{
+	int n = 0, k;
+
+	mutex_lock(&lcd.lock);
+	n += scnprintf(buf + n, PAGE_SIZE - n, "rom %s utf8 %s\n", lcd_charset.rom ? lcd_charset.rom->name : "none",
+		lcd.charset ? "on" : "off");
+	for (k = 0; k < LCD_GLYPHS; k++)
+		if (lcd_charset.glyph[k])
+			n += scnprintf(buf + n, PAGE_SIZE - n, "%d U+%.4X %*phN\n",
+				k, lcd_charset.glyph[k], 8, lcd_glyph_rows[k]);
+	mutex_unlock(&lcd.lock);
+	return n;
+}
 
-	return count;
+ssize_t store_attr_glyphs(struct device *dev, struct device_attribute * attr, const char *buf, size_t count)
+{
+	struct lcd_glyph_load load = {0};
+	char hex[17] = "";
+	long ret;
+	int n, k;
+
+	n = sscanf(buf, "U+%x %16s", &load.cp, hex);
+	if (n < 1 || !load.cp || load.cp >= 0x10000)
+		return -EINVAL;
+	if (n == 2) {
+		if (strlen(hex) != 16 || hex2bin(load.rows, hex, 8))
+			return -EINVAL;
+		for (k = 0; k < 8; k++)
+			load.rows[k] &= 0x1f;
+	}
+
+	load.unload = n == 1;
+
+	lcd_pm_get(&lcd);
+	ret = lcd_engine_run(lcd_engine_glyph, &load);
+	lcd_pm_put(&lcd);
+	return ret < 0 ? ret : count;
 }
 
-static DEVICE_ATTR(corrupt, S_IWUGO | S_IRUGO, show_attr_corrupt, store_attr_corrupt);
+static DEVICE_ATTR(glyphs, S_IWUSR | S_IRUGO, show_attr_glyphs, store_attr_glyphs);
 
-ssize_t show_attr_busy(struct device *dev, struct device_attribute * attr, char *buf)
+// who has the device open and what they have had of the bus
+ssize_t show_attr_writers(struct device *dev, struct device_attribute * attr, char *buf)
 {
-	lcd_busy_wait(&lcd);
-	return scnprintf(buf, PAGE_SIZE, "%d\n", atomic_read(&busy));
+	struct lcd_writer *w;
+	int n = 0;
+
+	spin_lock(&lcd_sched.lock);
+	list_for_each_entry(w, &lcd_sched.writers, node)
+		n += scnprintf(buf + n, PAGE_SIZE - n,
+			"pid %d comm %s weight %u writes %lu waits %lu bytes %llu cmds %llu bus %lluus\n",
+			w->pid, w->comm, w->weight, w->writes, w->waits, w->bytes, w->cmds, div_u64(w->bus_ns, 1000));
+	spin_unlock(&lcd_sched.lock);
+	return n;
 }
 
-static DEVICE_ATTR(busy, S_IRUGO, show_attr_busy, NULL);
+static DEVICE_ATTR(writers, S_IRUGO, show_attr_writers, NULL);
 
 static struct attribute *dev_attrs[] = {
 	&dev_attr_corrupt.attr,
 	&dev_attr_busy.attr,
+	&dev_attr_busy_model.attr,
+	&dev_attr_timing.attr,
+	&dev_attr_geometry.attr,
+	&dev_attr_scrub.attr,
+	&dev_attr_recovery.attr,
+	&dev_attr_queue.attr,
+	&dev_attr_plan.attr,
+	&dev_attr_pm.attr,
+	&dev_attr_sim.attr,
+	&dev_attr_fields.attr,
+	&dev_attr_triggers.attr,
+	&dev_attr_anim.attr,
+	&dev_attr_presets.attr,
+	&dev_attr_glyphs.attr,
+	&dev_attr_writers.attr,
 	NULL
 };
 
@@ -1024,8 +4043,60 @@ static struct attribute_group dev_attr_grp = {
 	.attrs = dev_attrs,
 };
 
+struct lcd_write {
+	const char *buf;
+	size_t count;
+	bool end;
+};
+
+static long lcd_engine_write(struct lcd_t *lcd, void *data)
+{
+	struct lcd_write *write = data;
+
+	lcd_print_text(write->buf, write->count, write->end);
+	lcd->last_write = jiffies;
+	return lcd->pos;
+}
+
+// write count bytes of buf as writer w, up to a nul as lcd_puts() would and a
+// piece at a time when other writers want the bus too, returns count or what
+// was written before a signal (or -ERESTARTSYS if nothing was)
+static ssize_t lcd_writer_write(struct lcd_writer *w, const char *buf, size_t count, loff_t *f_pos)
+{
+	struct lcd_write write;
+	size_t done = 0, len;
+	int ret = 0;
+
+	len = strnlen(buf, count);
+	lcd_pm_get(&lcd);
+	while (done < len) {
+		ret = lcd_sched_begin(w);
+		if (ret < 0)
+			break;
+		write.buf = buf + done;
+		write.count = len - done;
+		if (ret && write_slice > 0)
+			write.count = min_t(size_t, write.count, write_slice);
+		write.end = done + write.count == len;
+		*f_pos = lcd_writer_run(w, lcd_engine_write, &write);
+		lcd_sched_end();
+		done += write.count;
+	}
+	lcd_pm_put(&lcd);
+
+	spin_lock(&lcd_sched.lock);
+	w->writes++;
+	w->bytes += done;
+	spin_unlock(&lcd_sched.lock);
+
+	if (ret < 0)
+		return done ? done : ret;
+	return count;
+}
+
 ssize_t lcd_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
 {
+	struct lcd_writer *w = filp->private_data;
 	int ret = 0;
 	char *_buf = NULL;
 
@@ -1044,13 +4115,7 @@ ssize_t lcd_write(struct file *filp, const char __user *buf, size_t count, loff_
 		ret = -EFAULT;
 		goto exit;
 	}
-
-	// process buffer
-	lcd_print(_buf, count);
-	*f_pos = lcd.pos;
-
-	// success
-	ret = count;
+	ret = lcd_writer_write(w, _buf, count, f_pos);
 
 exit:
 	if (_buf)
@@ -1058,24 +4123,93 @@ exit:
 	return ret;
 }
 
-static atomic_t lcd_available = ATOMIC_INIT(1);
-
 int lcd_open(struct inode *inode, struct file *filp)
 {
-	if (!atomic_dec_and_test(&lcd_available)) {
-		atomic_inc(&lcd_available);
-		return -EBUSY; // already open
-	}
-
+	struct lcd_writer *w;
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL);
+	if (!w)
+		return -ENOMEM;
+	w->pid = task_tgid_nr(current);
+	get_task_comm(w->comm, current);
+	w->weight = LCD_WEIGHT_DEFAULT;
+	w->pos = -1;
+
+	spin_lock(&lcd_sched.lock);
+	w->vtime = lcd_sched.vclock;
+	list_add_tail(&w->node, &lcd_sched.writers);
+	spin_unlock(&lcd_sched.lock);
+
+	filp->private_data = w;
 	return 0;
 }
 
 int lcd_release(struct inode *inode, struct file *filp)
 {
-	atomic_inc(&lcd_available);
+	struct lcd_writer *w = filp->private_data;
+
+	spin_lock(&lcd_sched.lock);
+	list_del(&w->node);
+	spin_unlock(&lcd_sched.lock);
+	kfree(w);
 	return 0;
 }
 
+long lcd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct lcd_writer *w = filp->private_data;
+	struct lcd_anim *anim;
+	struct lcd_preset *preset;
+	__u32 weight, id;
+	int ret;
+
+	switch (cmd) {
+		case LCD_IOC_ANIM_PLAY:
+			anim = kmalloc(sizeof(*anim), GFP_KERNEL);
+			if (!anim)
+				return -ENOMEM;
+			if (copy_from_user(anim, (void __user *)arg, sizeof(*anim)))
+				ret = -EFAULT;
+			else
+				ret = lcd_anim_play(anim);
+			kfree(anim);
+			return ret;
+
+		case LCD_IOC_ANIM_STOP:
+			lcd_anim_stop();
+			return 0;
+
+		case LCD_IOC_WEIGHT:
+			if (copy_from_user(&weight, (void __user *)arg, sizeof(weight)))
+				return -EFAULT;
+			if (weight < 1 || weight > LCD_WEIGHT_MAX)
+				return -EINVAL;
+			spin_lock(&lcd_sched.lock);
+			w->weight = weight;
+			spin_unlock(&lcd_sched.lock);
+			return 0;
+
+		case LCD_IOC_PRESET_SET:
+			preset = kmalloc(sizeof(*preset), GFP_KERNEL);
+			if (!preset)
+				return -ENOMEM;
+			if (copy_from_user(preset, (void __user *)arg, sizeof(*preset)))
+				ret = -EFAULT;
+			else
+				ret = lcd_preset_set(preset);
+			kfree(preset);
+			return ret;
+
+		case LCD_IOC_PRESET_SHOW:
+			if (copy_from_user(&id, (void __user *)arg, sizeof(id)))
+				return -EFAULT;
+			return lcd_preset_show(w, id);
+
+		default:
+			return -ENOTTY;
+	}
+}
+
 #ifdef DEVNODE
 static struct file_operations fops = {
 	.owner = THIS_MODULE,
@@ -1083,6 +4217,75 @@ static struct file_operations fops = {
 	.llseek = lcd_llseek,
 	.open = lcd_open,
 	.release = lcd_release,
+	.unlocked_ioctl = lcd_ioctl,
+	.compat_ioctl = lcd_ioctl,	// the structs are laid out the same for both
+};
+
+// debugfs fls_lcd/capture, each open takes a snapshot of the capture ring
+// and any write clears it
+struct lcd_capture_snap {
+	size_t len;
+	struct lcd_capture_hdr hdr;
+	struct lcd_capture_rec rec[LCD_CAPTURE_SIZE];
+};
+
+static int lcd_capture_open(struct inode *inode, struct file *filp)
+{
+	struct lcd_capture_snap *snap;
+	unsigned int head, count, k;
+
+	snap = vmalloc(sizeof(*snap));
+	if (!snap)
+		return -ENOMEM;
+
+	// the bus is only driven with the lock held so this is consistent
+	mutex_lock(&lcd.lock);
+	head = atomic_read(&lcd_capture.head);
+	count = min_t(unsigned int, head, LCD_CAPTURE_SIZE);
+	for (k = 0; k < count; k++)
+		snap->rec[k] = lcd_capture.rec[(head - count + k) & (LCD_CAPTURE_SIZE - 1)];
+	snap->hdr.tn = lcd_capture.tn;
+	mutex_unlock(&lcd.lock);
+
+	snap->hdr.magic = LCD_CAPTURE_MAGIC;
+	snap->hdr.version = LCD_CAPTURE_VERSION;
+	snap->hdr.rec_size = sizeof(struct lcd_capture_rec);
+	snap->hdr.count = count;
+	snap->hdr.lost = head - count;
+	snap->len = sizeof(snap->hdr) + count * sizeof(struct lcd_capture_rec);
+	filp->private_data = snap;
+
+	return 0;
+}
+
+static ssize_t lcd_capture_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct lcd_capture_snap *snap = filp->private_data;
+
+	return simple_read_from_buffer(buf, count, f_pos, &snap->hdr, snap->len);
+}
+
+static ssize_t lcd_capture_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+{
+	mutex_lock(&lcd.lock);
+	atomic_set(&lcd_capture.head, 0);
+	mutex_unlock(&lcd.lock);
+
+	return count;
+}
+
+static int lcd_capture_release(struct inode *inode, struct file *filp)
+{
+	vfree(filp->private_data);
+	return 0;
+}
+
+static struct file_operations lcd_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = lcd_capture_open,
+	.read = lcd_capture_read,
+	.write = lcd_capture_write,
+	.release = lcd_capture_release,
 };
 
 #ifdef DEVNODE
@@ -1095,7 +4298,15 @@ static struct cdev cdev;
 
 int lcd_init(void)
 {
-	int ret = 0;
+	int ret = 0, k;
+	const char *profile = timing ? timing : (sim ? "sim" : NULL);
+	const char *layout = geometry;
+	const char *charset = rom;
+	const struct lcd_geometry *geo;
+	const struct lcd_rom *r;
+#ifdef CONFIG_OF
+	struct device_node *np;
+#endif
 #ifdef DEVNODE
 	dev_t devno;
 #endif
@@ -1103,6 +4314,49 @@ int lcd_init(void)
 	// start up msg
 	printk(KERN_INFO "FLS LCD driver started\n");
 
+	lcd_model_reset(&lcd);
+
+	// pick the bus timing profile and panel, the module params win over the
+	// device tree (whose strings live in the node, so it is held until
+	// they have been looked up)
+#ifdef CONFIG_OF
+	np = of_find_compatible_node(NULL, NULL, "fls,lcd");
+	if (np) {
+		if (!profile)
+			of_property_read_string(np, "timing-profile", &profile);
+		if (!layout)
+			of_property_read_string(np, "geometry", &layout);
+		if (!charset)
+			of_property_read_string(np, "rom", &charset);
+	}
+#endif
+	if (profile && lcd_timing_select(&lcd, profile) < 0)
+		printk(KERN_ERR "unknown lcd timing profile %s, using %s\n", profile, lcd.timing.name);
+	geo = layout ? lcd_geometry_find(layout) : &lcd_geometries[0];
+	if (!geo) {
+		geo = &lcd_geometries[0];
+		printk(KERN_ERR "unknown lcd geometry %s, using %s\n", layout, geo->name);
+	}
+	lcd_map_build(&lcd_map, geo);
+	r = charset ? lcd_rom_find(charset) : &lcd_roms[0];
+	if (!r) {
+		r = &lcd_roms[0];
+		printk(KERN_ERR "unknown lcd rom %s, using %s\n", charset, r->name);
+	}
+#ifdef CONFIG_OF
+	of_node_put(np);
+#endif
+	lcd_charset_build(&lcd_charset, r);
+	if (utf8)
+		lcd.charset = &lcd_charset;
+
+	// a simulated lcd for every controller the panel has
+	for (k = 0; sim && k < lcd_map.ctrls; k++) {
+		lcd_sim[k].timing = sim > 1;
+		lcd_sim_reset(&lcd_sim[k]);
+		lcd.dio->sim[k] = &lcd_sim[k];
+	}
+
 	// init the registers etc
 	ret = dio_init(lcd.dio);
 	if (ret < 0) {
@@ -1118,12 +4372,19 @@ int lcd_init(void)
 
 		// do 4 bit init sequence (see datasheet, p16)
 		// this ensures we get in sync with the lcd
-		lcd_4bit_init(&lcd, lcd_lines_2, lcd_font_5by8);
+		lcd_4bit_init(&lcd, lcd_lines_2, lcd_font_5by8, false);
+
+		// the display is still off so now is the time to tune the timings
+		if (calibrate)
+			lcd_calibrate(&lcd);
 
 		// now do our init
 		lcd_clear(&lcd);
 		lcd_home(&lcd);
 		lcd_display_control(&lcd, lcd_display_on, lcd_cursor_off, lcd_blink_off);
+	} else if (attach) {
+		// pick up where the last user of the lcd left off
+		lcd_attach(&lcd);
 	} else {
 		// just home the cursor if we are not doing a full reset, this way at least we know where we are
 		lcd_home(&lcd);
@@ -1133,6 +4394,13 @@ int lcd_init(void)
 	if (strlen(splash_msg) > 0)
 		lcd_print(splash_msg, strlen(splash_msg));
 
+	// from here on the lcd is ours to show a panic on
+	if (panic_msg)
+		atomic_notifier_chain_register(&panic_notifier_list, &lcd_panic_nb);
+	lcd_engine_start(&lcd);
+	lcd_anim_init();
+	lcd_con_register();
+
 #ifdef DEVNODE
 	// allocate a new dev number (this can be dynamic or
 	// static if passed in as a module param)
@@ -1145,15 +4413,16 @@ int lcd_init(void)
 	}
 	if (ret < 0) {
 		printk(KERN_ERR "alloc_chrdev_region failed\n");
-		goto fail;
+		goto fail0;
 	}
 
 	// create a dummy class for the lcd
-	cl = class_create(THIS_MODULE, "lcd");
+	cl = lcd_class_create("lcd");
 	if (IS_ERR(cl)) {
 		printk(KERN_ERR "class_simple_create for class lcd failed\n");
 		goto fail1;
 	}
+	cl->pm = &lcd_pm_ops;
 
 	// create cdev interface
 	cdev_init(&cdev, &fops);
@@ -1178,6 +4447,34 @@ int lcd_init(void)
 		goto fail4;
 	}
 
+	// the named field files, the lcd is still usable without them
+	lcd_fields_kobj = kobject_create_and_add("field", &dev->kobj);
+	if (!lcd_fields_kobj)
+		printk(KERN_ERR "kobject_create_and_add for field failed\n");
+
+	// let the lcd go to sleep when nobody is writing to it
+	lcd.dev = dev;
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, autosuspend > 0 ? autosuspend * 1000 : -1);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+
+	// the capture ring is only a debugging aid so carry on without debugfs
+	lcd_debugfs = debugfs_create_dir("fls_lcd", NULL);
+	if (!IS_ERR_OR_NULL(lcd_debugfs)) {
+		debugfs_create_file("capture", S_IRUSR | S_IWUSR, lcd_debugfs, NULL, &lcd_capture_fops);
+#if defined(CONFIG_FAULT_INJECTION_DEBUG_FS) && LINUX_VERSION_CODE >= KERNEL_VERSION(3, 1, 0)
+		fault_create_debugfs_attr("fail_drop", lcd_debugfs, &fail_lcd_drop);
+		fault_create_debugfs_attr("fail_dup", lcd_debugfs, &fail_lcd_dup);
+		fault_create_debugfs_attr("fail_flip", lcd_debugfs, &fail_lcd_flip);
+		fault_create_debugfs_attr("fail_busy", lcd_debugfs, &fail_lcd_busy);
+#endif
+	}
+
+	// start looking for corruption in the background
+	if (lcd_scrubbing())
+		schedule_delayed_work(&scrub_work, msecs_to_jiffies(scrub));
+
 	return 0;
 #endif
 
@@ -1190,6 +4487,12 @@ fail2:
 	class_destroy(cl);
 fail1:
 	unregister_chrdev_region(devno, 1);
+fail0:
+	lcd_con_unregister();
+	lcd_anim_stop();
+	lcd_engine_stop(&lcd);
+	if (panic_msg)
+		atomic_notifier_chain_unregister(&panic_notifier_list, &lcd_panic_nb);
 #endif
 fail:
 	// deinit registers etc
@@ -1199,15 +4502,37 @@ fail:
 
 void lcd_cleanup(void)
 {
+	lcd_con_unregister();
+	if (panic_msg)
+		atomic_notifier_chain_unregister(&panic_notifier_list, &lcd_panic_nb);
+
 #ifdef DEVNODE
-	// clean up device node
+	cancel_delayed_work_sync(&scrub_work);
+	debugfs_remove_recursive(lcd_debugfs);
+
+	// stop the fields and any animation drawing before the lcd goes away
+	// under them
 	sysfs_remove_group(&dev->kobj, &dev_attr_grp);
+	cancel_delayed_work_sync(&trigger_work);
+	lcd_anim_stop();
+	lcd_fields_remove();
+
+	// leave the lcd on for whoever comes next
+	pm_runtime_get_sync(dev);
+	pm_runtime_disable(dev);
+	pm_runtime_put_noidle(dev);
+	lcd.dev = NULL;
+
+	// clean up device node
 	device_destroy(cl, MKDEV(major, 0));
 	cdev_del(&cdev);
 	class_destroy(cl);
 	unregister_chrdev_region(MKDEV(major, 0), 1);
 #endif
 
+	// nobody is left to hand the engine work
+	lcd_engine_stop(&lcd);
+
 	// deinit registers etc
 	dio_deinit(lcd.dio);
 
@@ -1215,6 +4540,10 @@ void lcd_cleanup(void)
 	printk(KERN_INFO "FLS LCD driver done\n");
 }
 
+#ifdef CONFIG_FLS_LCD_KUNIT_TEST
+#include "fls_lcd_test.c"
+#endif
+
 #ifdef MODULE
 module_init(lcd_init);
 #else 
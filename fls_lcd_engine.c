@@ -0,0 +1,518 @@
+/*
+ * FLS front panel lcd print engine
+ *
+ * The escape parser and the cursor addressing (am, position wrapping). This
+ * is #included by fls_lcd.c and by lcd_host.c so the same code runs in the
+ * driver and natively on a developer machine for fuzzing and benchmarks.
+ *
+ * The includer defines struct lcd_t (with at least pos, am, wstate and map,
+ * see lcd_map_build(), and charset, NULL to pass bytes straight through, and
+ * utf8), printk() and these bus commands before including this file:
+ *   lcd_set_dram_addr(), lcd_home(), lcd_clear(), lcd_cursor(),
+ *   lcd_blink() and lcd_putchar()
+ */
+#include "fls_lcd_engine.h"
+
+// the panels we know, the first is the default
+static const struct lcd_geometry lcd_geometries[] = {
+	{"16x4", 16, 4, {0x00, 0x40, 0x10, 0x50}, {0x20, 0x21, 0x60, 0x61}, {0x67, 0x66, 0x27, 0x26}},
+	{"16x2", 16, 2, {0x00, 0x40},             {0x20, 0x60},             {0x27, 0x67}},
+	{"20x2", 20, 2, {0x00, 0x40},             {0x20, 0x60},             {0x27, 0x67}},
+	{"20x4", 20, 4, {0x00, 0x40, 0x14, 0x54}, {0x13, 0x53, 0x27, 0x67}, {0x00, 0x40, 0x14, 0x54}},
+	{"40x2", 40, 2, {0x00, 0x40},             {0x27, 0x67},             {0x00, 0x40}},
+	{"40x4", 40, 4, {0x00, 0x40, 0x80, 0xc0}, {0x27, 0x67, 0xa7, 0xe7}, {0x00, 0x40, 0x80, 0xc0}},
+};
+
+static const struct lcd_geometry *lcd_geometry_find(const char *name)
+{
+	int k;
+
+	for (k = 0; k < sizeof(lcd_geometries) / sizeof(lcd_geometries[0]); k++)
+		if (!strcmp(name, lcd_geometries[k].name))
+			return &lcd_geometries[k];
+	return NULL;
+}
+
+// the character roms we know, by the code points in them (ascii is the same
+// in both bar a00's 0x5c, 0x7e and 0x7f and never gets looked up)
+static const struct lcd_rom_range lcd_rom_a00[] = {
+	{0x00a0, 0x20, 1},	// nbsp
+	{0x00a2, 0xec, 1},	// ¢
+	{0x00a5, 0x5c, 1},	// ¥
+	{0x00b0, 0xdf, 1},	// °
+	{0x00b5, 0xe4, 1},	// µ
+	{0x00b7, 0xa5, 1},	// ·
+	{0x00df, 0xe2, 1},	// ß
+	{0x00e4, 0xe1, 1},	// ä
+	{0x00f1, 0xee, 1},	// ñ
+	{0x00f6, 0xef, 1},	// ö
+	{0x00f7, 0xfd, 1},	// ÷
+	{0x00fc, 0xf5, 1},	// ü
+	{0x03a3, 0xf6, 1},	// Σ
+	{0x03a9, 0xf4, 1},	// Ω
+	{0x03b1, 0xe0, 1},	// α
+	{0x03b2, 0xe2, 1},	// β
+	{0x03b5, 0xe3, 1},	// ε
+	{0x03b8, 0xf2, 1},	// θ
+	{0x03bc, 0xe4, 1},	// μ
+	{0x03c0, 0xf7, 1},	// π
+	{0x03c1, 0xe6, 1},	// ρ
+	{0x03c3, 0xe5, 1},	// σ
+	{0x2126, 0xf4, 1},	// Ω ohm
+	{0x2190, 0x7f, 1},	// ←
+	{0x2192, 0x7e, 1},	// →
+	{0x221a, 0xe8, 1},	// √
+	{0x221e, 0xf3, 1},	// ∞
+	{0x2588, 0xff, 1},	// █
+	{0x4e07, 0xfb, 1},	// 万
+	{0x5343, 0xfa, 1},	// 千
+	{0x5186, 0xfc, 1},	// 円
+	{0xff61, 0xa1, 63},	// halfwidth katakana and punctuation
+};
+
+static const struct lcd_rom_range lcd_rom_a02[] = {
+	{0x00a0, 0xa0, 96},	// the top half follows latin-1
+	{0x0393, 0x92, 1},	// Γ
+	{0x0398, 0x99, 1},	// Θ
+	{0x03a3, 0x94, 1},	// Σ
+	{0x03a9, 0x9a, 1},	// Ω
+	{0x03b1, 0x90, 1},	// α
+	{0x03b4, 0x9b, 1},	// δ
+	{0x03b5, 0x9e, 1},	// ε
+	{0x03c0, 0x93, 1},	// π
+	{0x03c3, 0x95, 1},	// σ
+	{0x03c4, 0x97, 1},	// τ
+	{0x0411, 0x80, 1},	// Б
+	{0x0414, 0x81, 1},	// Д
+	{0x0416, 0x82, 4},	// Ж З И Й
+	{0x041b, 0x86, 1},	// Л
+	{0x041f, 0x87, 1},	// П
+	{0x0423, 0x88, 1},	// У
+	{0x0426, 0x89, 6},	// Ц Ч Ш Щ Ъ Ы
+	{0x042d, 0x8f, 1},	// Э
+	{0x201c, 0x12, 2},	// “ ”
+	{0x2126, 0x9a, 1},	// Ω ohm
+	{0x2190, 0x1b, 1},	// ←
+	{0x2191, 0x18, 1},	// ↑
+	{0x2192, 0x1a, 1},	// →
+	{0x2193, 0x19, 1},	// ↓
+	{0x21b2, 0x17, 1},	// ↲
+	{0x221e, 0x9c, 1},	// ∞
+	{0x2229, 0x9f, 1},	// ∩
+	{0x2264, 0x1c, 2},	// ≤ ≥
+	{0x23eb, 0x14, 2},	// ⏫ ⏬
+	{0x25b2, 0x1e, 1},	// ▲
+	{0x25b6, 0x10, 1},	// ▶
+	{0x25bc, 0x1f, 1},	// ▼
+	{0x25c0, 0x11, 1},	// ◀
+	{0x25cf, 0x16, 1},	// ●
+	{0x2665, 0x9d, 1},	// ♥
+	{0x266a, 0x91, 1},	// ♪
+	{0x266c, 0x96, 1},	// ♬
+};
+
+// the first is the default
+static const struct lcd_rom lcd_roms[] = {
+	{"a00", lcd_rom_a00, sizeof(lcd_rom_a00) / sizeof(lcd_rom_a00[0])},
+	{"a02", lcd_rom_a02, sizeof(lcd_rom_a02) / sizeof(lcd_rom_a02[0])},
+};
+
+static const struct lcd_rom *lcd_rom_find(const char *name)
+{
+	int k;
+
+	for (k = 0; k < sizeof(lcd_roms) / sizeof(lcd_roms[0]); k++)
+		if (!strcmp(name, lcd_roms[k].name))
+			return &lcd_roms[k];
+	return NULL;
+}
+
+static void lcd_charset_set(struct lcd_charset *cs, uint32_t cp, uint8_t code)
+{
+	int page;
+
+	if (cp >= 0x10000)
+		return;
+	page = cs->page[cp >> 8];
+	if (!page) {
+		if (cs->pages == LCD_CHARSET_PAGES)
+			return;
+		page = cs->page[cp >> 8] = ++cs->pages;
+	}
+	cs->code[page - 1][cp & 0xff] = code;
+}
+
+// work out the code for every code point once, so putting one is a lookup
+// whatever the rom, a glyph loaded for a code point takes over from the rom
+static void lcd_charset_build(struct lcd_charset *cs, const struct lcd_rom *rom)
+{
+	int k, j;
+
+	cs->rom = rom;
+	cs->pages = 0;
+	memset(cs->page, 0, sizeof(cs->page));
+	memset(cs->code, 0, sizeof(cs->code));
+	for (k = 0; k < rom->count; k++)
+		for (j = 0; j < rom->ranges[k].n; j++)
+			lcd_charset_set(cs, rom->ranges[k].cp + j, rom->ranges[k].code + j);
+	for (k = 0; k < LCD_GLYPHS; k++)
+		if (cs->glyph[k])
+			lcd_charset_set(cs, cs->glyph[k], 0x08 + k);
+}
+
+// bytes in the utf-8 sequence c starts, 0 if it doesn't start one
+static int lcd_utf8_want(uint8_t c)
+{
+	if (c < 0xc2 || c > 0xf4)
+		return 0;
+	return c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+}
+
+// feed byte c to the decoder u, the code points it completes go in cp[] (up
+// to 4, a sequence that turns out not to be one is its bytes as LCD_CP_ROM()
+// so text already in the lcd's own codes still works), returns how many
+static int lcd_utf8_feed(struct lcd_utf8 *u, uint8_t c, uint32_t *cp)
+{
+	static const uint32_t least[] = {0, 0, 0x80, 0x800, 0x10000};
+	int n = 0, k;
+
+	if (u->len) {
+		if ((c & 0xc0) == 0x80) {
+			u->raw[u->len++] = c;
+			u->cp = u->cp << 6 | (c & 0x3f);
+			if (u->len < u->want)
+				return 0;
+
+			// overlong, a surrogate or past unicode isn't text
+			u->len = 0;
+			if (u->cp >= least[u->want] && (u->cp < 0xd800 || u->cp >= 0xe000) && u->cp <= 0x10ffff) {
+				cp[0] = u->cp;
+				return 1;
+			}
+			for (k = 0; k < u->want; k++)
+				cp[k] = LCD_CP_ROM(u->raw[k]);
+			return u->want;
+		}
+		for (k = 0; k < u->len; k++)
+			cp[n++] = LCD_CP_ROM(u->raw[k]);
+		u->len = 0;
+	}
+
+	u->want = lcd_utf8_want(c);
+	if (!u->want) {
+		cp[n++] = c < 0x80 ? c : LCD_CP_ROM(c);
+		return n;
+	}
+	u->cp = c & (0x3f >> (u->want - 1));
+	u->raw[0] = c;
+	u->len = 1;
+	return n;
+}
+
+// work out where the cursor goes from every dram address, once, so moving it
+// is a lookup whatever the panel
+static void lcd_map_build(struct lcd_map *map, const struct lcd_geometry *geo)
+{
+	int a, x, y, am, first, last;
+
+	memset(map, 0, sizeof(*map));
+	map->geo = geo;
+	map->cols = geo->cols;
+	map->lines = geo->lines;
+	map->cells = geo->cols * geo->lines;
+
+	// lines in the top half of the addresses are on a second controller
+	map->ctrls = (geo->start[geo->lines - 1] >> 7) + 1;
+
+	// off screen the cursor just follows the address counter
+	for (a = 0; a < LCD_ADDRS; a++) {
+		for (am = 0; am < 2; am++) {
+			map->next[am][a] = lcd_ac_next(a);
+			map->prev[am][a] = lcd_ac_prev(a);
+		}
+		map->unpark[a] = a;
+		map->x[a] = -1;
+		map->y[a] = -1;
+	}
+
+	// parked the cursor stays put until am comes back on (the cells below
+	// take over where a park is the end cell itself)
+	for (y = 0; y < geo->lines; y++) {
+		first = geo->start[y];
+		last = first + geo->cols - 1;
+		map->next[0][geo->eolpp[y]] = map->prev[0][geo->eolpp[y]] = geo->eolpp[y];
+		map->next[0][geo->solmm[y]] = map->prev[0][geo->solmm[y]] = geo->solmm[y];
+		map->unpark[geo->eolpp[y]] = last;
+		map->unpark[geo->solmm[y]] = first;
+	}
+
+	for (y = 0; y < geo->lines; y++) {
+		first = geo->start[y];
+		last = first + geo->cols - 1;
+		for (x = 0; x < geo->cols; x++) {
+			a = first + x;
+			map->x[a] = x;
+			map->y[a] = y;
+			map->addr[y * geo->cols + x] = a;
+			map->unpark[a] = a;
+			for (am = 0; am < 2; am++) {
+				map->next[am][a] = a + 1;
+				map->prev[am][a] = a - 1;
+			}
+		}
+
+		// automatic margins wrap to the next (or previous) line, without
+		// we park off the end of this one
+		map->next[1][last] = geo->start[(y + 1) % geo->lines];
+		map->next[0][last] = geo->eolpp[y];
+		map->prev[1][first] = geo->start[(y + geo->lines - 1) % geo->lines] + geo->cols - 1;
+		map->prev[0][first] = geo->solmm[y];
+	}
+
+	for (a = 0; a < LCD_ADDRS; a++) {
+		for (am = 0; am < 2; am++) {
+			map->jump_next[am][a] = map->next[am][a] != lcd_ac_next(a);
+			map->jump_prev[am][a] = map->prev[am][a] != lcd_ac_prev(a);
+		}
+	}
+}
+
+static void lcd_set_am(struct lcd_t *lcd, bool am)
+{
+	int pos = lcd->map->unpark[lcd->pos];
+
+	// when am comes on a cursor parked off a line goes back onto it, going
+	// off we are already at a valid location and will just roll off the
+	// eol or sol naturally
+	if (am && !lcd->am && pos != lcd->pos)
+		lcd_set_dram_addr(lcd, pos);
+
+	lcd->am = am;
+}
+
+// the lcd moves its address counter on after a char by itself, so it only
+// needs telling at the ends of lines (and to stay put when parked)
+static void lcd_inc_pos(struct lcd_t *lcd)
+{
+	const struct lcd_map *map = lcd->map;
+
+	if (map->jump_next[lcd->am][lcd->pos])
+		lcd_set_dram_addr(lcd, map->next[lcd->am][lcd->pos]);
+	else
+		lcd->pos = map->next[lcd->am][lcd->pos];
+}
+
+static void lcd_dec_pos(struct lcd_t *lcd)
+{
+	const struct lcd_map *map = lcd->map;
+
+	if (map->jump_prev[lcd->am][lcd->pos])
+		lcd_set_dram_addr(lcd, map->prev[lcd->am][lcd->pos]);
+	else
+		lcd->pos = map->prev[lcd->am][lcd->pos];
+}
+
+void lcd_getxy(struct lcd_t *lcd, int *x, int *y)
+{
+	bool am = lcd->am;
+
+	lcd_set_am(lcd, true);
+	*x = lcd->map->x[lcd->pos];
+	*y = lcd->map->y[lcd->pos];
+	if (*y < 0) {
+		// how did we get here !!
+		*x = 0;
+		*y = 0;
+	}
+	lcd_set_am(lcd, am);
+}
+
+int lcd_gotoxy(struct lcd_t *lcd, int x, int y, enum whence_t whence)
+{
+	int r = 0;
+	int dp;
+	bool am = lcd->am;
+
+	switch (whence) {
+		case WHENCE_ABS:
+			// bounds check x,y
+			if (y * lcd->map->cols + x > lcd->map->cells)
+				return -1;
+			lcd_home(lcd);
+			// now we are at 0 fall through to relative moves
+
+		case WHENCE_REL:
+			// x,y are not bounds check on relative moves (they just wrap)
+			dp = y * lcd->map->cols + x;
+			if (dp < 0) {
+				lcd_set_am(lcd, true);
+				while (dp++ != 0)
+					lcd_dec_pos(lcd);
+				lcd_set_am(lcd, am);
+			}
+			else if (dp > 0) {
+				lcd_set_am(lcd, true);
+				while (dp-- != 0)
+					lcd_inc_pos(lcd);
+				lcd_set_am(lcd, am);
+			}
+			break;
+	}
+
+	lcd_set_dram_addr(lcd, lcd->pos);
+	return r;
+}
+
+// returns whether c was taken as text, ascii is left to the parser (for the
+// escapes and controls) unless it is the end of a sequence that wasn't one
+static bool lcd_utf8(struct lcd_t *lcd, char ch)
+{
+	uint8_t c = ch;
+	uint32_t cp[4];
+	int n, k;
+
+	if (c < 0x80 && !lcd->utf8.len)
+		return false;
+
+	// ascii comes back last, after the bytes it cut off
+	n = lcd_utf8_feed(&lcd->utf8, c, cp);
+	if (c < 0x80)
+		n--;
+	for (k = 0; k < n; k++)
+		lcd_putchar(lcd, lcd_charset_code(lcd->charset, cp[k]));
+	return c >= 0x80;
+}
+
+// run count bytes of buf through the parser, returns how many were used
+static ssize_t lcd_puts(struct lcd_t *lcd, const char *buf, size_t count)
+{
+	size_t l;
+	int x, y;
+
+	for (l = 0; l < count && buf[l] != 0; l++)
+	{
+		switch (lcd->wstate)
+		{
+			case WRITE_STATE_NORMAL:
+				if (lcd->charset && lcd_utf8(lcd, buf[l]))
+					break;
+				switch(buf[l])
+				{
+					case 0x1b:
+						// escape char mode !
+						lcd->wstate = WRITE_STATE_ESCAPE1;
+						break;
+					case '\n':
+						// new line
+						lcd_gotoxy(lcd, 0, 1, WHENCE_REL);
+						break;
+					case '\r':
+						// cr (goto x = 0)
+						lcd_getxy(lcd, &x, &y);
+						lcd_gotoxy(lcd, -x, 0, WHENCE_REL);
+						break;
+					case '\t':
+						// tab (align to 4 bytes), count the spaces up front
+						// as with am off the cursor sticks at the end of
+						// the line and x would never reach the tab stop
+						lcd_getxy(lcd, &x, &y);
+						do
+						{
+							lcd_putchar(lcd, ' ');
+						}
+						while (++x % 4 != 0);
+						break;
+					case '\b':
+						// backspace
+						lcd_gotoxy(lcd, -1, 0, WHENCE_REL);
+						break;
+					default:
+						// normal characters
+						lcd_putchar(lcd, buf[l]);
+						break;
+				}
+				break;
+
+			case WRITE_STATE_ESCAPE1:
+				switch(buf[l])
+				{
+					case 'a':
+						// all attributes off (blink = 0)
+						lcd_cursor(lcd, 0);
+						lcd_blink(lcd, 0);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'b':
+						// blink on
+						lcd_blink(lcd, 1);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'v':
+						// cursor visible
+						lcd_cursor(lcd, 1);
+						lcd_blink(lcd, 0);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'V':
+						// cursor invisible
+						lcd_cursor(lcd, 0);
+						lcd_blink(lcd, 0);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'h':
+						// cursor high visible (cursor with block blink)
+						lcd_blink(lcd, 1);
+						lcd_cursor(lcd, 0);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'H':
+						// home cursor wtf does this mean (0,0 or sol)?
+						lcd_gotoxy(lcd, 0, 0, WHENCE_ABS);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'J':
+						// clear screen and home the cursor
+						lcd_clear(lcd);
+						lcd_gotoxy(lcd, 0, 0, WHENCE_ABS);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'B':
+						// move down 1
+						lcd_gotoxy(lcd, 0, 1, WHENCE_REL);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'A':
+						// move up 1
+						lcd_gotoxy(lcd, 0, -1, WHENCE_REL);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'D':
+						// move left 1
+						lcd_gotoxy(lcd, -1, 0, WHENCE_REL);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'C':
+						// move right 1
+						lcd_gotoxy(lcd, 1, 0, WHENCE_REL);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'm':
+						lcd_set_am(lcd, true);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					case 'M':
+						lcd_set_am(lcd, false);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+					default:
+						// unknown escape code (just dump the output)
+						printk(KERN_WARNING "unknown escape code %.2x\n", buf[l]);
+						lcd->wstate = WRITE_STATE_NORMAL;
+						break;
+				}
+				break;
+		}
+	}
+
+	return l;
+}
@@ -0,0 +1,131 @@
+/*
+ * FLS front panel lcd print engine, shared by the driver and the host build
+ *
+ * Screen geometry and the parser / addressing state. The includer supplies
+ * uint8_t, int8_t, bool, size_t and ssize_t.
+ */
+#ifndef FLS_LCD_ENGINE_H
+#define FLS_LCD_ENGINE_H
+
+#define LCD_DRAM_SIZE (0x80)	// of one controller
+#define LCD_CTRLS     (2)	// 40x4 panels have two, bit 7 of an address picks one
+#define LCD_ADDRS     (LCD_CTRLS * LCD_DRAM_SIZE)
+#define LCD_MAX_LINES (4)
+#define LCD_MAX_COLS  (40)
+#define LCD_MAX_CELLS (160)	// all the chars both controllers' dram holds
+
+// a panel's layout in dram, eolpp and solmm are the addresses we park the
+// cursor on when am is off and it runs off the end (EOLPP) or start (SOLMM)
+// of a line, spare dram where there is some, otherwise the end cell itself
+// (so chars past the end overwrite the last one, like a terminal)
+struct lcd_geometry {
+	const char *name;
+	int cols;
+	int lines;
+	uint8_t start[LCD_MAX_LINES];
+	uint8_t eolpp[LCD_MAX_LINES];
+	uint8_t solmm[LCD_MAX_LINES];
+};
+
+// a geometry turned into lookups by dram address (see lcd_map_build())
+struct lcd_map {
+	const struct lcd_geometry *geo;
+	int cols;
+	int lines;
+	int cells;
+	int ctrls;				// controllers the lines are spread over
+	uint8_t next[2][LCD_ADDRS];		// [am] where the cursor goes after a char
+	uint8_t prev[2][LCD_ADDRS];		// [am] and moving back
+	bool jump_next[2][LCD_ADDRS];		// the move needs an address set as the
+	bool jump_prev[2][LCD_ADDRS];		// lcd doesn't get there by itself
+	uint8_t unpark[LCD_ADDRS];		// where a parked cursor goes when am comes on
+	int8_t x[LCD_ADDRS];			// -1 off screen
+	int8_t y[LCD_ADDRS];
+	uint8_t addr[LCD_MAX_CELLS];		// of each cell, left to right top to bottom
+};
+
+// the address counter moves on after each data read or write, from the end
+// of each half of dram on to the start of the other (a controller's address
+// counter never takes it to the other controller)
+static inline int lcd_ac_next(int addr)
+{
+	int ctrl = addr & 0x80;
+
+	addr &= 0x7f;
+	if (addr == 0x27)
+		return ctrl | 0x40;
+	if (addr == 0x67)
+		return ctrl;
+	return ctrl | ((addr + 1) & 0x7f);
+}
+
+static inline int lcd_ac_prev(int addr)
+{
+	return (addr & 0x80) | ((addr - 1) & 0x7f);
+}
+
+// a run of n code points from cp that are in a character rom from code on
+struct lcd_rom_range {
+	uint32_t cp;
+	uint8_t code;
+	uint8_t n;
+};
+
+struct lcd_rom {
+	const char *name;
+	const struct lcd_rom_range *ranges;
+	int count;
+};
+
+#define LCD_GLYPHS        (8)	// cgram chars
+#define LCD_CHARSET_PAGES (20)	// enough for either rom and a page per glyph
+
+// a rom and the glyphs loaded into cgram turned into a lookup by code point
+// (see lcd_charset_build()), a page of codes for each 256 code points with
+// any in, code 0 for none as cgram chars are put at their 0x08-0x0f copies
+struct lcd_charset {
+	const struct lcd_rom *rom;
+	uint32_t glyph[LCD_GLYPHS];		// code point in each cgram slot, 0 free
+	uint8_t page[256];			// by code point >> 8, 1 + the page
+	uint8_t code[LCD_CHARSET_PAGES][256];
+	int pages;
+};
+
+// a utf-8 sequence part way through, raw as it came for when it turns out
+// not to be one
+struct lcd_utf8 {
+	uint32_t cp;
+	uint8_t len;
+	uint8_t want;
+	uint8_t raw[4];
+};
+
+// U+F000-U+F0FF put the rom's own code (the low byte) whatever the charset, as
+// the linux console's direct font access does, a byte that isn't part of a
+// utf-8 sequence is decoded as one of these
+#define LCD_CP_ROM(code) (0xf000 | (code))
+
+// the code cp is put as, ascii and the direct range are their own and without
+// a charset nothing else has one
+static inline uint8_t lcd_charset_code(const struct lcd_charset *cs, uint32_t cp)
+{
+	int page;
+	uint8_t code;
+
+	if (cp < 0x80 || (cp & ~0xff) == LCD_CP_ROM(0))
+		return cp & 0xff;
+	if (!cs)
+		return '?';
+	page = cp < 0x10000 ? cs->page[cp >> 8] : 0;
+	code = page ? cs->code[page - 1][cp & 0xff] : 0;
+	return code ? code : '?';
+}
+
+enum write_state {
+	WRITE_STATE_NORMAL,
+	WRITE_STATE_ESCAPE1
+};
+
+enum whence_t {WHENCE_ABS, WHENCE_REL};
+
+#endif
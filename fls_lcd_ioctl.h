@@ -0,0 +1,58 @@
+/*
+ * FLS front panel lcd ioctls, shared by the driver and userspace
+ *
+ * An animation is a timeline of steps the driver plays by itself from a
+ * timer, each step a run of chars put at a cell (counting left to right,
+ * top to bottom from 0) and shown for ms before the next. Text is utf-8 as for
+ * writes (len is in bytes), so a char can take more than one. A step with ms 0
+ * is drawn together with the one after it, so a frame can change several
+ * places at once. The timeline plays loops times (0 for until stopped or
+ * replaced), then leaves its last frame on the lcd.
+ *
+ * A preset is a whole screen (cells as for animations, a nul ends it early
+ * and leaves the rest blank) kept in the driver under an id. Showing one
+ * sends only the cells that differ from what is up, without a clear, so
+ * switching between menu screens is quick and doesn't flicker.
+ *
+ * Each open of the device shares the bus with the others by its weight
+ * (default 100, 1 to 10000), set with LCD_IOC_WEIGHT.
+ */
+#ifndef FLS_LCD_IOCTL_H
+#define FLS_LCD_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define LCD_ANIM_STEPS (64)
+#define LCD_ANIM_TEXT  (16)
+
+struct lcd_anim_step {
+	__u16 ms;
+	__u8 cell;
+	__u8 len;
+	char text[LCD_ANIM_TEXT];
+};
+
+struct lcd_anim {
+	__u16 steps;
+	__u16 loops;
+	struct lcd_anim_step step[LCD_ANIM_STEPS];
+};
+
+#define LCD_PRESETS      (16)
+#define LCD_PRESET_CELLS (160)
+#define LCD_PRESET_TEXT  (4 * LCD_PRESET_CELLS)	// utf-8 for every cell
+
+struct lcd_preset {
+	__u32 id;
+	char text[LCD_PRESET_TEXT];
+};
+
+#define LCD_IOC_MAGIC     'L'
+#define LCD_IOC_ANIM_PLAY _IOW(LCD_IOC_MAGIC, 1, struct lcd_anim)
+#define LCD_IOC_ANIM_STOP _IO(LCD_IOC_MAGIC, 2)
+#define LCD_IOC_WEIGHT    _IOW(LCD_IOC_MAGIC, 3, __u32)
+#define LCD_IOC_PRESET_SET  _IOW(LCD_IOC_MAGIC, 4, struct lcd_preset)
+#define LCD_IOC_PRESET_SHOW _IOW(LCD_IOC_MAGIC, 5, __u32)
+
+#endif
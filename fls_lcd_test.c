@@ -0,0 +1,973 @@
+/*
+ * FLS front panel lcd driver KUnit tests
+ *
+ * This is included at the end of fls_lcd.c (so it can get at the static
+ * driver functions) and runs the print engine against the simulated lcd.
+ * Each test checks what ended up on the screen and caps the number of bus
+ * cycles (e strobes) and commands it took, so changes that make the driver
+ * chattier fail here rather than on the glass. If you make the driver
+ * cheaper lower the caps to match.
+ */
+#include <kunit/test.h>
+
+static struct lcd_sim lcd_test_sim;
+static struct lcd_sim lcd_test_sim2;	// the second controller of a 40x4
+static struct dio_t lcd_test_dio = {.sim = {&lcd_test_sim, &lcd_test_sim2}, .e = {E, E2}};
+static struct lcd_t lcd_test_saved;
+static int lcd_test_saved_busy_model;
+static int lcd_test_saved_frame;
+static struct lcd_map lcd_test_map;
+
+// everything in lcd from dio on is the lcd's state, what comes before it (the
+// lock, the engine and the device) lasts as long as the driver
+#define LCD_TEST_STATE offsetof(struct lcd_t, dio)
+
+#define LCD_EXPECT_LINE(test, y, str) do { \
+	char _line[LCD_MAX_COLS + 1]; \
+	lcd_sim_line(&lcd_test_dio, lcd.map, y, _line); \
+	KUNIT_EXPECT_STREQ(test, _line, str); \
+} while (0)
+
+// caps on e strobes and commands, and the exact number of chars written
+#define LCD_EXPECT_BUS(test, _nibbles, _cmds, _data) do { \
+	KUNIT_EXPECT_LE(test, lcd_test_sim.nibbles, (unsigned long)(_nibbles)); \
+	KUNIT_EXPECT_LE(test, lcd_test_sim.cmds, (unsigned long)(_cmds)); \
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_writes, (unsigned long)(_data)); \
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.violations, 0UL); \
+} while (0)
+
+static void lcd_test_print(const char *s)
+{
+	lcd_print(s, strlen(s));
+}
+
+static int lcd_test_init(struct kunit *test)
+{
+	// the tests drive the global lcd, so park the driver's own workers
+	// (the tests run as the module loads, before any writer) and save all
+	// of its state under the lock
+	lcd_anim_stop();
+	cancel_delayed_work_sync(&scrub_work);
+	cancel_delayed_work_sync(&trigger_work);
+	cancel_delayed_work_sync(&con_work);
+	mutex_lock(&lcd.lock);
+	memcpy((char *)&lcd_test_saved + LCD_TEST_STATE, (char *)&lcd + LCD_TEST_STATE, sizeof(lcd) - LCD_TEST_STATE);
+	lcd_test_saved_busy_model = busy_model;
+	lcd_test_saved_frame = frame;
+
+	// then point it at a fresh simulated lcd, put through the same init
+	// as lcd_init() with hw_reset
+	lcd.dio = &lcd_test_dio;
+	lcd_map_build(&lcd_test_map, lcd_geometry_find("16x4"));
+	lcd.map = &lcd_test_map;
+	lcd_timing_select(&lcd, "sim");
+	lcd_sim_reset(&lcd_test_sim);
+	lcd_sim_reset(&lcd_test_sim2);
+	lcd.wstate = WRITE_STATE_NORMAL;
+	lcd.am = true;
+	lcd_model_reset(&lcd);
+	busy_model = 0;
+	frame = 0;
+
+	lcd_4bit_init(&lcd, lcd_lines_2, lcd_font_5by8, false);
+	lcd_clear(&lcd);
+	lcd_home(&lcd);
+	lcd_display_control(&lcd, lcd_display_on, lcd_cursor_off, lcd_blink_off);
+	lcd_sim_clear_stats(&lcd_test_sim);
+	mutex_unlock(&lcd.lock);
+
+	return 0;
+}
+
+static void lcd_test_exit(struct kunit *test)
+{
+	// the real lcd never saw the tests so its state is as it was
+	mutex_lock(&lcd.lock);
+	memcpy((char *)&lcd + LCD_TEST_STATE, (char *)&lcd_test_saved + LCD_TEST_STATE, sizeof(lcd) - LCD_TEST_STATE);
+	busy_model = lcd_test_saved_busy_model;
+	frame = lcd_test_saved_frame;
+	mutex_unlock(&lcd.lock);
+
+	// and let the workers back at it, the trigger work only carries on
+	// if a field is still bound
+	if (lcd_scrubbing())
+		schedule_delayed_work(&scrub_work, msecs_to_jiffies(scrub));
+	schedule_delayed_work(&trigger_work, 0);
+}
+
+static void lcd_test_hello(struct kunit *test)
+{
+	lcd_test_print("hello world");
+
+	LCD_EXPECT_LINE(test, 0, "hello world     ");
+	LCD_EXPECT_LINE(test, 1, "                ");
+	KUNIT_EXPECT_EQ(test, lcd.pos, 11);
+	LCD_EXPECT_BUS(test, 132, 11, 11);
+}
+
+static void lcd_test_gotoxy(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, lcd_gotoxy(&lcd, 3, 2, WHENCE_ABS), 0);
+	lcd_test_print("x");
+	KUNIT_EXPECT_EQ(test, lcd_gotoxy(&lcd, 15, 3, WHENCE_ABS), 0);
+	lcd_test_print("y");
+
+	LCD_EXPECT_LINE(test, 2, "   x            ");
+	LCD_EXPECT_LINE(test, 3, "               y");
+	LCD_EXPECT_BUS(test, 32, 4, 2);
+}
+
+static void lcd_test_escapes(struct kunit *test)
+{
+	lcd_test_print("junk\eJ\eHab\eBc\eDd\eAe\eCf");
+
+	LCD_EXPECT_LINE(test, 0, "ab e f          ");
+	LCD_EXPECT_LINE(test, 1, "  d             ");
+	LCD_EXPECT_BUS(test, 140, 15, 10);
+
+	// cursor and blink end up in display control
+	lcd_test_print("\ev");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.control, 0x08 | lcd_display_on | lcd_cursor_on | lcd_blink_off);
+	lcd_test_print("\eh");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.control, 0x08 | lcd_display_on | lcd_cursor_off | lcd_blink_on);
+	lcd_test_print("\ea");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.control, 0x08 | lcd_display_on | lcd_cursor_off | lcd_blink_off);
+}
+
+static void lcd_test_am_wrap(struct kunit *test)
+{
+	// automatic margins wrap on to the next line, and from the last back to the first
+	lcd_test_print("0123456789abcdefg");
+	LCD_EXPECT_LINE(test, 0, "0123456789abcdef");
+	LCD_EXPECT_LINE(test, 1, "g               ");
+
+	KUNIT_EXPECT_EQ(test, lcd_gotoxy(&lcd, 14, 3, WHENCE_ABS), 0);
+	lcd_test_print("XYZ");
+	LCD_EXPECT_LINE(test, 3, "              XY");
+	LCD_EXPECT_LINE(test, 0, "Z123456789abcdef");
+	LCD_EXPECT_BUS(test, 252, 23, 20);
+}
+
+static void lcd_test_no_am(struct kunit *test)
+{
+	// without automatic margins the cursor sticks at the end of the line
+	lcd_test_print("\eM0123456789abcdefghij");
+	LCD_EXPECT_LINE(test, 0, "0123456789abcdef");
+	LCD_EXPECT_LINE(test, 1, "                ");
+
+	// but relative moves still wrap
+	lcd_test_print("\r\b\b\bk\emk");
+	LCD_EXPECT_LINE(test, 0, "0123456789abcdef");
+	LCD_EXPECT_LINE(test, 3, "             kk ");
+	LCD_EXPECT_BUS(test, 284, 27, 22);
+}
+
+static void lcd_test_control_chars(struct kunit *test)
+{
+	lcd_test_print("ab\r\ncd\n\r\tx\b\by");
+
+	LCD_EXPECT_LINE(test, 0, "ab              ");
+	LCD_EXPECT_LINE(test, 1, "cd              ");
+	LCD_EXPECT_LINE(test, 2, "   yx           ");
+	LCD_EXPECT_BUS(test, 132, 13, 10);
+}
+
+static void lcd_test_tab_no_am(struct kunit *test)
+{
+	// a tab with the cursor stuck at the end of the line has to give up
+	// rather than wait for a tab stop it can never reach
+	lcd_test_print("\eM0123456789abcdefg\tz");
+	LCD_EXPECT_LINE(test, 0, "0123456789abcde ");
+	LCD_EXPECT_LINE(test, 1, "                ");
+}
+
+static void lcd_test_geometry(struct kunit *test)
+{
+	const struct lcd_geometry *geo;
+	int cell, a, wrong;
+
+	// with am the cursor steps through every panel's cells in reading
+	// order and back round to the first
+	for (geo = lcd_geometries; geo < lcd_geometries + ARRAY_SIZE(lcd_geometries); geo++) {
+		lcd_map_build(&lcd_test_map, geo);
+		a = lcd_test_map.addr[0];
+		wrong = 0;
+		for (cell = 1; cell <= lcd_test_map.cells; cell++) {
+			a = lcd_test_map.next[1][a];
+			wrong += a != lcd_test_map.addr[cell % lcd_test_map.cells];
+		}
+		KUNIT_EXPECT_EQ_MSG(test, wrong, 0, "geometry %s", geo->name);
+	}
+
+	// a 20x4 uses all of dram, so with am off the cursor sticks on the
+	// last cell, and the end of line 4 runs on into line 1 by itself
+	lcd_map_build(&lcd_test_map, lcd_geometry_find("20x4"));
+	lcd_test_print("\eJ0123456789abcdefghijk\eB\eB\eMabcdefghijklmnopqrstu");
+	LCD_EXPECT_LINE(test, 0, "0123456789abcdefghij");
+	LCD_EXPECT_LINE(test, 1, "k                   ");
+	LCD_EXPECT_LINE(test, 3, " abcdefghijklmnopqru");
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("\em!?");
+	LCD_EXPECT_LINE(test, 3, " abcdefghijklmnopqr!");
+	LCD_EXPECT_LINE(test, 0, "?123456789abcdefghij");
+	LCD_EXPECT_BUS(test, 28, 3, 2);
+	KUNIT_EXPECT_FALSE(test, lcd_test_map.jump_next[1][lcd_test_map.addr[lcd_test_map.cells - 1]]);
+}
+
+static void lcd_test_dual(struct kunit *test)
+{
+	char text[LCD_MAX_CELLS + 1], line[LCD_MAX_COLS + 1];
+	unsigned int head, k, e = 0, turns = 0;
+	int y;
+
+	// a 40x4 is two controllers, the top two lines and the bottom two,
+	// that share the bus but for their e lines
+	lcd_map_build(&lcd_test_map, lcd_geometry_find("40x4"));
+	lcd_4bit_init(&lcd, lcd_lines_2, lcd_font_5by8, false);
+	lcd_clear(&lcd);
+	lcd_home(&lcd);
+	lcd_display_control(&lcd, lcd_display_on, lcd_cursor_off, lcd_blink_off);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim2.control, lcd_test_sim.control);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim2.entry, lcd_test_sim.entry);
+
+	// text runs on from one's lines to the other's
+	KUNIT_EXPECT_EQ(test, lcd_gotoxy(&lcd, 36, 1, WHENCE_ABS), 0);
+	lcd_test_print("abcdefgh");
+	LCD_EXPECT_LINE(test, 1, "                                    abcd");
+	LCD_EXPECT_LINE(test, 2, "efgh                                    ");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim2.data_writes, 4UL);
+
+	// and only the one the cursor is on shows it
+	lcd_test_print("\ev");
+	KUNIT_EXPECT_TRUE(test, lcd_test_sim2.control & lcd_cursor_on);
+	KUNIT_EXPECT_FALSE(test, lcd_test_sim.control & lcd_cursor_on);
+	lcd_test_print("\eH");
+	KUNIT_EXPECT_TRUE(test, lcd_test_sim.control & lcd_cursor_on);
+	KUNIT_EXPECT_FALSE(test, lcd_test_sim2.control & lcd_cursor_on);
+	lcd_test_print("\eV");
+
+	// a full screen in frame mode takes turns between the two, so each
+	// is busy with its last char while the other's next goes out
+	lcd_test_sim.timing = lcd_test_sim2.timing = true;
+	busy_model = 1;
+	frame = 1;
+	for (k = 0; k < LCD_MAX_CELLS; k++)
+		text[k] = 'A' + k % 26;
+	text[k] = 0;
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_sim_clear_stats(&lcd_test_sim2);
+	atomic_set(&lcd_capture.head, 0);
+	lcd_test_print("\eH");
+	lcd_test_print(text);
+	head = atomic_read(&lcd_capture.head);
+	KUNIT_ASSERT_LT(test, head, (unsigned int)LCD_CAPTURE_SIZE);
+	for (k = 0; k < head; k++) {
+		if ((lcd_capture.rec[k].a & LCD_CAPTURE_GET) || !(lcd_capture.rec[k].b & (E | E2)))
+			continue;
+		turns += e && e != (lcd_capture.rec[k].b & (E | E2));
+		e = lcd_capture.rec[k].b & (E | E2);
+	}
+	KUNIT_EXPECT_GE(test, turns, (unsigned int)LCD_MAX_CELLS - 2);
+	for (y = 0; y < 4; y++) {
+		lcd_sim_line(&lcd_test_dio, lcd.map, y, line);
+		KUNIT_EXPECT_EQ(test, memcmp(line, text + y * 40, 40), 0);
+	}
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_writes + lcd_test_sim2.data_writes, (unsigned long)LCD_MAX_CELLS);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.violations, 0UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim2.violations, 0UL);
+	lcd_test_sim.timing = lcd_test_sim2.timing = false;
+}
+
+static void lcd_test_peephole(struct kunit *test)
+{
+	// escapes that leave cursor and blink as they are send nothing, the
+	// ones that do change them go out as one display control
+	lcd_test_print("\ea\eV");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.cmds, 0UL);
+	lcd_test_print("\ev\eb");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.cmds, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.control, 0x08 | lcd_display_on | lcd_cursor_on | lcd_blink_on);
+
+	// home is a single address set, not a 1.5ms home
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd.queue.homes = 0;
+	lcd_test_print("x\eH");
+	KUNIT_EXPECT_EQ(test, lcd.queue.homes, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd.pos, 0);
+	LCD_EXPECT_BUS(test, 16, 2, 1);
+}
+
+static void lcd_test_lazy_cursor(struct kunit *test)
+{
+	// only the last of a run of moves is sent, when there is a char to
+	// write
+	lcd_test_print("ab");
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd.queue.moves = 0;
+	lcd_test_print("\r\n\r\n\eC\eD");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.cmds, 0UL);
+	lcd_test_print("c");
+	LCD_EXPECT_LINE(test, 2, "c               ");
+	KUNIT_EXPECT_GE(test, lcd.queue.moves, 5UL);
+	LCD_EXPECT_BUS(test, 16, 2, 1);
+
+	// but a visible cursor follows every write
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("\ev\eB");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.cmds, 2UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.ac, lcd.map->geo->start[3] + 1);
+}
+
+static void lcd_test_scrub(struct kunit *test)
+{
+	int saved_peephole = peephole, saved_scrub;
+
+	// a healthy lcd passes a whole scrub pass without a resync, even
+	// with the address sets queued
+	peephole = 1;
+	lcd_test_sim.timing = true;
+	lcd_test_print("scrub");
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd.scrub_checked = lcd.scrub_repairs = lcd.scrub_resyncs = 0;
+	mutex_lock(&lcd.lock);
+	lcd_scrub(&lcd, lcd.map->cells);
+	mutex_unlock(&lcd.lock);
+	KUNIT_EXPECT_EQ(test, lcd.scrub_checked, (unsigned long)lcd.map->cells);
+	KUNIT_EXPECT_EQ(test, lcd.scrub_resyncs, 0UL);
+	KUNIT_EXPECT_EQ(test, lcd.scrub_repairs, 0UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_writes, 0UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.violations, 0UL);
+
+	// and a cell that has gone wrong is put back
+	lcd_test_sim.ddram[1] = 'x';
+	mutex_lock(&lcd.lock);
+	lcd_scrub(&lcd, lcd.map->cells);
+	mutex_unlock(&lcd.lock);
+	LCD_EXPECT_LINE(test, 0, "scrub           ");
+	KUNIT_EXPECT_EQ(test, lcd.scrub_resyncs, 0UL);
+	KUNIT_EXPECT_EQ(test, lcd.scrub_repairs, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.violations, 0UL);
+
+	lcd_test_print("!");
+	LCD_EXPECT_LINE(test, 0, "scrub!          ");
+	lcd_test_sim.timing = false;
+	peephole = saved_peephole;
+
+	// chars are only left unchecked when the scrubber is running
+	saved_scrub = scrub;
+	scrub = -1;
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("?");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_reads, 1UL);
+	scrub = 1000;
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("?");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_reads, 0UL);
+	scrub = saved_scrub;
+}
+
+static void lcd_test_frame(struct kunit *test)
+{
+	char blank[2 + LCD_MAX_CELLS];
+	int k;
+
+	frame = 1;
+
+	// the end of line 1 runs on into line 3 in dram, so no address sets
+	lcd_test_print("0123456789abcdef\eBg");
+	LCD_EXPECT_LINE(test, 0, "0123456789abcdef");
+	LCD_EXPECT_LINE(test, 2, "g               ");
+	LCD_EXPECT_BUS(test, 68, 0, 17);
+
+	// redrawing it with one char changed sends just that char (and puts
+	// the cursor back)
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("\eH0123456789Abcdef\eBg");
+	LCD_EXPECT_LINE(test, 0, "0123456789Abcdef");
+	LCD_EXPECT_BUS(test, 8, 1, 1);
+
+	// two changes a char apart take two address sets, rewriting the char
+	// between them would be dearer, unless the lcd's address sets turn
+	// out to be slower than its data writes
+	memset(&lcd.plan, 0, sizeof(lcd.plan));
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("\eH0123456789abCdef\eBg");
+	LCD_EXPECT_LINE(test, 0, "0123456789abCdef");
+	LCD_EXPECT_BUS(test, 16, 2, 2);
+	KUNIT_EXPECT_EQ(test, lcd.plan.fills, 0UL);
+
+	lcd.model[LCD_CMD_ADDR].est = 2 * Texec_data;
+	memset(&lcd.plan, 0, sizeof(lcd.plan));
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("\eH0123456789AbcDef\eBg");
+	LCD_EXPECT_LINE(test, 0, "0123456789AbcDef");
+	LCD_EXPECT_BUS(test, 20, 1, 4);
+	KUNIT_EXPECT_EQ(test, lcd.plan.addrs, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd.plan.fills, 1UL);
+	lcd_model_reset(&lcd);
+
+	// clearing a full screen to write one char is a clear and one char
+	for (k = 0; k < lcd.map->cells; k++)
+		lcd_test_print("#");
+	memset(&lcd.plan, 0, sizeof(lcd.plan));
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_test_print("\eJx");
+	LCD_EXPECT_LINE(test, 0, "x               ");
+	LCD_EXPECT_LINE(test, 3, "                ");
+	LCD_EXPECT_BUS(test, 8, 1, 1);
+	KUNIT_EXPECT_EQ(test, lcd.plan.clears, 1UL);
+	KUNIT_EXPECT_LE(test, lcd.plan.planned_ns, lcd.plan.naive_ns);
+
+	// and blanking most of one is a clear too, but what the frame left
+	// as it was has to be put back after it
+	for (k = 0; k < lcd.map->cells; k++)
+		lcd_test_print("#");
+	memset(&lcd.plan, 0, sizeof(lcd.plan));
+	lcd_sim_clear_stats(&lcd_test_sim);
+	memset(blank, ' ', sizeof(blank));
+	memcpy(blank, "\eH", 2);
+	lcd_print(blank, 2 + lcd.map->cells - 4);
+	LCD_EXPECT_LINE(test, 0, "                ");
+	LCD_EXPECT_LINE(test, 3, "            ####");
+	KUNIT_EXPECT_EQ(test, lcd.plan.clears, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_writes, 4UL);
+}
+
+static void lcd_test_panic(struct kunit *test)
+{
+	// a panic can land with the lock held and the lcd half way through a
+	// byte, the message still has to come out whole
+	lcd_test_sim.timing = true;
+	lcd_test_print("status ok");
+	mutex_lock(&lcd.lock);
+	lcd_bus_write4(&lcd, 1, 'x');
+
+	lcd_panic_notify(&lcd_panic_nb, 0, "Attempted to kill init! exitcode=0x00000009\n");
+	lcd_test_sim.timing = false;
+	mutex_unlock(&lcd.lock);
+
+	LCD_EXPECT_LINE(test, 0, "KERNEL PANIC    ");
+	LCD_EXPECT_LINE(test, 1, "Attempted to kil");
+	LCD_EXPECT_LINE(test, 2, "l init! exitcode");
+	LCD_EXPECT_LINE(test, 3, "=0x00000009     ");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.violations, 0UL);
+}
+
+static void lcd_test_console(struct kunit *test)
+{
+	static const char *msgs[] = {
+		"6,1,100,-;booting\n",
+		"4,2,110,-;eth0: link\\x20up\n SUBSYSTEM=net\n DEVICE=+net:eth0\n",
+		"6,3,120,-;a message too long for the lcd\n",
+		"7,4,130,-;debug noise\n",
+	};
+	int saved_con_lines = con_lines, saved_con_level = con_level;
+	int k;
+
+	con_lines = 2;
+	con_level = 6;
+	lcd_con_blank(lcd_con.text[0], LCD_MAX_LINES * LCD_MAX_COLS);
+	lcd_con.queued = false;
+	lcd_con.redraws = 0;
+	lcd_test_print("status");
+	lcd_sim_clear_stats(&lcd_test_sim);
+
+	// a burst of messages is one redraw of the latest lines (leaving out
+	// the less urgent ones), around whatever else is on the lcd
+	for (k = 0; k < ARRAY_SIZE(msgs); k++)
+		lcd_con_write(NULL, msgs[k], strlen(msgs[k]));
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.sets, 0UL);
+	KUNIT_EXPECT_TRUE(test, lcd_con.queued);
+	cancel_delayed_work_sync(&con_work);
+	lcd_con_work(NULL);
+	con_lines = saved_con_lines;
+	con_level = saved_con_level;
+
+	LCD_EXPECT_LINE(test, 0, "status          ");
+	LCD_EXPECT_LINE(test, 2, "eth0: link up   ");
+	LCD_EXPECT_LINE(test, 3, "a message too lo");
+	KUNIT_EXPECT_EQ(test, lcd_con.redraws, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_writes, 2UL * lcd.map->cols);
+	lcd_test_print("!");
+	LCD_EXPECT_LINE(test, 0, "status!         ");
+}
+
+static void lcd_test_engine(struct kunit *test)
+{
+	struct lcd_write write = {.buf = "engine", .count = 6};
+	bool start = !lcd.engine;
+
+	// bus work handed to the engine thread is done by the time the
+	// caller gets its result back (the driver's own engine may already be
+	// running)
+	if (start)
+		lcd_engine_start(&lcd);
+	KUNIT_EXPECT_TRUE(test, lcd.engine != NULL);
+	KUNIT_EXPECT_EQ(test, lcd_engine_run(lcd_engine_write, &write), 6L);
+	LCD_EXPECT_LINE(test, 0, "engine          ");
+	if (start) {
+		lcd_engine_stop(&lcd);
+		KUNIT_EXPECT_TRUE(test, lcd.engine == NULL);
+	}
+}
+
+static void lcd_test_fields(struct kunit *test)
+{
+	struct lcd_field_draw old, draw;
+	struct lcd_field *f;
+
+	KUNIT_EXPECT_EQ(test, lcd_field_define("cpu 10 1 6 right %d"), 0);
+	KUNIT_EXPECT_EQ(test, lcd_field_define("cpu 0 0 4"), -EEXIST);
+	KUNIT_EXPECT_EQ(test, lcd_field_define("wide 8 0 9"), -EINVAL);
+	KUNIT_EXPECT_EQ(test, lcd_field_define("bad 0 0 4 left %n"), -EINVAL);
+	KUNIT_EXPECT_EQ(test, lcd_field_define("host 0 2 16 center"), 0);
+	f = lcd_field_find("cpu");
+	KUNIT_ASSERT_TRUE(test, f != NULL);
+
+	// a field is drawn in place around whatever else is on the lcd
+	lcd_test_print("status");
+	KUNIT_EXPECT_EQ(test, lcd_field_set(f, "42\n", 3), 0);
+	KUNIT_EXPECT_EQ(test, lcd_field_set(lcd_field_find("host"), "fls", 3), 0);
+	LCD_EXPECT_LINE(test, 1, "              42");
+	LCD_EXPECT_LINE(test, 2, "      fls       ");
+	KUNIT_EXPECT_EQ(test, lcd_field_set(f, "x", 1), -EINVAL);
+
+	// and a new value only sends the cells that changed
+	lcd_sim_clear_stats(&lcd_test_sim);
+	KUNIT_EXPECT_EQ(test, lcd_field_set(f, "-43", 3), 0);
+	LCD_EXPECT_LINE(test, 1, "             -43");
+	LCD_EXPECT_BUS(test, 16, 2, 2);
+
+	// a draw that a newer value overtook leaves the lcd alone
+	mutex_lock(&lcd_fields_lock);
+	lcd_field_update(f, "1", &old);
+	lcd_field_update(f, "2", &draw);
+	mutex_unlock(&lcd_fields_lock);
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_field_draw(&old);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.nibbles, 0UL);
+	lcd_field_draw(&draw);
+	LCD_EXPECT_LINE(test, 1, "               2");
+	lcd_test_print("!");
+	LCD_EXPECT_LINE(test, 0, "status!         ");
+
+	KUNIT_EXPECT_EQ(test, lcd_field_remove("cpu"), 0);
+	KUNIT_EXPECT_EQ(test, lcd_field_remove("cpu"), -ENOENT);
+	KUNIT_EXPECT_EQ(test, lcd_field_remove("host"), 0);
+}
+
+static void lcd_test_triggers(struct kunit *test)
+{
+	char line[LCD_MAX_COLS + 1];
+	struct lcd_field *f;
+
+	KUNIT_ASSERT_EQ(test, lcd_field_define("up 6 3 10 right"), 0);
+	KUNIT_EXPECT_EQ(test, lcd_trigger_bind("up", "bogus", ""), -EINVAL);
+	KUNIT_EXPECT_EQ(test, lcd_trigger_bind("up", "temp", ""), -EINVAL);
+	KUNIT_EXPECT_EQ(test, lcd_trigger_bind("down", "uptime", ""), -ENOENT);
+	KUNIT_EXPECT_EQ(test, lcd_trigger_bind("up", "uptime", ""), 0);
+	cancel_delayed_work_sync(&trigger_work);
+	f = lcd_field_find("up");
+
+	// a refresh draws the source into the field
+	lcd_trigger_work(NULL);
+	lcd_sim_line(&lcd_test_dio, lcd.map, 3, line);
+	KUNIT_EXPECT_STREQ(test, line + lcd.map->cols - strlen(f->text), f->text);
+	KUNIT_EXPECT_TRUE(test, strchr(f->text, ':') != NULL);
+
+	// and one that finds it unchanged leaves the lcd alone
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_trigger_work(NULL);
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.nibbles, 0UL);
+
+	KUNIT_EXPECT_EQ(test, lcd_trigger_bind("up", "none", ""), 0);
+	cancel_delayed_work_sync(&trigger_work);
+	KUNIT_EXPECT_TRUE(test, f->trig == NULL);
+	KUNIT_EXPECT_EQ(test, lcd_field_remove("up"), 0);
+}
+
+static void lcd_test_anim(struct kunit *test)
+{
+	static struct lcd_anim anim = {
+		.steps = 3,
+		.loops = 1,
+		.step = {
+			{.ms = 0,     .cell = 0,  .len = 4, .text = "load"},
+			{.ms = 10000, .cell = 31, .len = 1, .text = "-"},
+			{.ms = 10000, .cell = 31, .len = 1, .text = "\\"},
+		},
+	};
+	static struct lcd_anim bad, blank;
+	int k;
+
+	KUNIT_EXPECT_EQ(test, lcd_anim_play(&bad), -EINVAL);
+	bad = anim;
+	bad.step[2].ms = 0;
+	KUNIT_EXPECT_EQ(test, lcd_anim_play(&bad), -EINVAL);
+	bad = anim;
+	bad.step[0].cell = lcd.map->cells - 2;
+	KUNIT_EXPECT_EQ(test, lcd_anim_play(&bad), -EINVAL);
+
+	// the first frame goes straight away, with the steps before it (the
+	// a of status is left as it is)
+	lcd_test_print("status");
+	lcd_sim_clear_stats(&lcd_test_sim);
+	KUNIT_ASSERT_EQ(test, lcd_anim_play(&anim), 0);
+	flush_work(&lcd_player.work);
+	LCD_EXPECT_LINE(test, 0, "loadus          ");
+	LCD_EXPECT_LINE(test, 1, "               -");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.data_writes, 4UL);
+
+	// the next changes just its char, and ends the last loop
+	lcd_sim_clear_stats(&lcd_test_sim);
+	lcd_anim_work(&lcd_player.work);
+	LCD_EXPECT_LINE(test, 1, "               \\");
+	LCD_EXPECT_BUS(test, 8, 1, 1);
+	KUNIT_EXPECT_FALSE(test, lcd_player.playing);
+	lcd_anim_stop();
+
+	lcd_test_print("!");
+	LCD_EXPECT_LINE(test, 0, "loadus!         ");
+
+	// a frame that blanks most of the lcd is still sent without a clear,
+	// which would flash the cells it leaves as they are
+	for (k = 0; k < lcd.map->cells; k++)
+		lcd_test_print("#");
+	blank.steps = lcd.map->lines;
+	blank.loops = 1;
+	for (k = 0; k < blank.steps; k++) {
+		blank.step[k].cell = k * lcd.map->cols;
+		blank.step[k].len = k < blank.steps - 1 ? lcd.map->cols : lcd.map->cols - 4;
+		memset(blank.step[k].text, ' ', blank.step[k].len);
+	}
+	blank.step[blank.steps - 1].ms = 10000;
+	memset(&lcd.plan, 0, sizeof(lcd.plan));
+	KUNIT_ASSERT_EQ(test, lcd_anim_play(&blank), 0);
+	flush_work(&lcd_player.work);
+	lcd_anim_stop();
+	LCD_EXPECT_LINE(test, 0, "                ");
+	LCD_EXPECT_LINE(test, 3, "            ####");
+	KUNIT_EXPECT_EQ(test, lcd.plan.clears, 0UL);
+}
+
+static void lcd_test_writers(struct kunit *test)
+{
+	struct file a = {0}, b = {0};
+	struct lcd_writer *wa, *wb, *w;
+	int k, turns[2] = {0, 0};
+
+	KUNIT_ASSERT_EQ(test, lcd_open(NULL, &a), 0);
+	KUNIT_ASSERT_EQ(test, lcd_open(NULL, &b), 0);
+	wa = a.private_data;
+	wb = b.private_data;
+
+	// each open has its own cursor
+	lcd_writer_write(wa, "\eHone", 5, &a.f_pos);
+	lcd_llseek(&b, 16, 0);
+	lcd_writer_write(wb, "two", 3, &b.f_pos);
+	lcd_writer_write(wa, "!", 1, &a.f_pos);
+	LCD_EXPECT_LINE(test, 0, "one!            ");
+	LCD_EXPECT_LINE(test, 1, "two             ");
+
+	// and is charged for what it sent
+	KUNIT_EXPECT_EQ(test, wa->writes, 2UL);
+	KUNIT_EXPECT_EQ(test, wa->bytes, 6ULL);
+	KUNIT_EXPECT_GE(test, wa->cmds, 4ULL);
+	KUNIT_EXPECT_GT(test, wa->bus_ns, 0ULL);
+	KUNIT_EXPECT_EQ(test, wb->bytes, 3ULL);
+
+	// with both always waiting the bus goes 3 to 1 to the heavier one
+	wb->weight = 300;
+	wa->vtime = 0;
+	wb->vtime = 0;
+	for (k = 0; k < 400; k++) {
+		wa->waiting = true;
+		wb->waiting = true;
+		w = lcd_sched_next();
+		turns[w == wb]++;
+		lcd_sched_charge(w, 1000);
+	}
+	wa->waiting = false;
+	wb->waiting = false;
+	KUNIT_EXPECT_GE(test, turns[1], 298);
+	KUNIT_EXPECT_LE(test, turns[1], 302);
+
+	lcd_release(NULL, &a);
+	lcd_release(NULL, &b);
+	KUNIT_EXPECT_TRUE(test, list_empty(&lcd_sched.writers));
+}
+
+static void lcd_test_presets(struct kunit *test)
+{
+	struct lcd_preset preset = {0};
+	struct file f = {0};
+
+	KUNIT_ASSERT_EQ(test, lcd_open(NULL, &f), 0);
+	memset(preset.text, '#', sizeof(preset.text));
+	KUNIT_EXPECT_EQ(test, lcd_preset_set(&preset), 0);
+	memset(preset.text, 0, sizeof(preset.text));
+	preset.id = 1;
+	strcpy(preset.text, "> Settings      ");
+	KUNIT_EXPECT_EQ(test, lcd_preset_set(&preset), 0);
+	preset.id = 2;
+	strcpy(preset.text, "  Settings      > Network");
+	KUNIT_EXPECT_EQ(test, lcd_preset_set(&preset), 0);
+
+	KUNIT_EXPECT_EQ(test, lcd_preset_show(f.private_data, 0), 0);
+	LCD_EXPECT_LINE(test, 3, "################");
+
+	// a mostly blank screen over a full one is still never a clear
+	memset(&lcd.plan, 0, sizeof(lcd.plan));
+	lcd_sim_clear_stats(&lcd_test_sim);
+	KUNIT_EXPECT_EQ(test, lcd_preset_show(f.private_data, 1), 0);
+	LCD_EXPECT_LINE(test, 0, "> Settings      ");
+	LCD_EXPECT_LINE(test, 3, "                ");
+	KUNIT_EXPECT_EQ(test, lcd.plan.clears, 0UL);
+
+	// moving the selection sends only the cells that differ
+	lcd_sim_clear_stats(&lcd_test_sim);
+	KUNIT_EXPECT_EQ(test, lcd_preset_show(f.private_data, 2), 0);
+	LCD_EXPECT_LINE(test, 0, "  Settings      ");
+	LCD_EXPECT_LINE(test, 1, "> Network       ");
+	LCD_EXPECT_BUS(test, 4 * (9 + 3), 3, 9);
+
+	KUNIT_EXPECT_EQ(test, lcd_preset_show(f.private_data, 3), -ENOENT);
+	KUNIT_EXPECT_EQ(test, lcd_preset_show(f.private_data, LCD_PRESETS), -EINVAL);
+	lcd_release(NULL, &f);
+}
+
+static void lcd_test_utf8(struct kunit *test)
+{
+	static const char glyph[] = "U+2665 0a1f1f1f0e040000";
+	static const uint8_t rows[8] = {0x0a, 0x1f, 0x1f, 0x1f, 0x0e, 0x04, 0x00, 0x00};
+	struct lcd_charset *saved = lcd.charset;
+	struct lcd_preset preset = {0};
+	struct file f = {0};
+	char spec[32];
+	int k;
+
+	lcd_charset_build(&lcd_charset, lcd_rom_find("a00"));
+	lcd.charset = &lcd_charset;
+
+	// the rom's own codes, and bytes that aren't utf-8 as they are
+	lcd_test_print("25\xc2\xb0" "C \xe2\x86\x92 \xff\xc3(");
+	LCD_EXPECT_LINE(test, 0, "25\xdf" "C \x7e \xff\xc3(      ");
+
+	// a lead byte that ends the write is the rom's code, not held back
+	lcd_test_print(" 9\xdf");
+	LCD_EXPECT_LINE(test, 0, "25\xdf" "C \x7e \xff\xc3( 9\xdf   ");
+
+	// a code point the rom doesn't have comes out as '?' until it has a
+	// glyph, and the text after loading one still goes where it should
+	KUNIT_EXPECT_EQ(test, lcd_gotoxy(&lcd, 0, 1, WHENCE_ABS), 0);
+	lcd_test_print("\xe2\x99\xa5");
+	LCD_EXPECT_LINE(test, 1, "?               ");
+	KUNIT_EXPECT_EQ(test, store_attr_glyphs(NULL, NULL, glyph, sizeof(glyph)), (ssize_t)sizeof(glyph));
+	KUNIT_EXPECT_EQ(test, memcmp(lcd_test_sim.cgram, rows, sizeof(rows)), 0);
+	lcd_test_print("\xe2\x99\xa5!");
+	LCD_EXPECT_LINE(test, 1, "?\x08!             ");
+
+	KUNIT_EXPECT_EQ(test, store_attr_glyphs(NULL, NULL, "U+2665", 6), (ssize_t)6);
+	KUNIT_EXPECT_EQ(test, store_attr_glyphs(NULL, NULL, "U+2665", 6), (ssize_t)-ENOENT);
+	KUNIT_EXPECT_EQ(test, store_attr_glyphs(NULL, NULL, "U+2665 0a1f", 11), (ssize_t)-EINVAL);
+
+	// every slot taken is an error, not a glyph silently lost
+	for (k = 0; k <= LCD_GLYPHS; k++) {
+		snprintf(spec, sizeof(spec), "U+%.4X 0a1f1f1f0e040000", 0x2460 + k);
+		KUNIT_EXPECT_EQ(test, store_attr_glyphs(NULL, NULL, spec, strlen(spec)),
+			k < LCD_GLYPHS ? (ssize_t)strlen(spec) : (ssize_t)-ENOSPC);
+	}
+	for (k = 0; k < LCD_GLYPHS; k++) {
+		snprintf(spec, sizeof(spec), "U+%.4X", 0x2460 + k);
+		KUNIT_EXPECT_EQ(test, store_attr_glyphs(NULL, NULL, spec, strlen(spec)), (ssize_t)strlen(spec));
+	}
+
+	// U+F0xx is the rom's own code whatever the charset
+	KUNIT_EXPECT_EQ(test, lcd_gotoxy(&lcd, 0, 2, WHENCE_ABS), 0);
+	lcd_test_print("\xef\x83\xa4\xef\x81\x9c");
+	LCD_EXPECT_LINE(test, 2, "\xe4\x5c              ");
+
+	// and fields and presets are text like any other, aligned by cells
+	KUNIT_ASSERT_EQ(test, lcd_field_define("temp 12 3 4 right"), 0);
+	KUNIT_EXPECT_EQ(test, lcd_field_set(lcd_field_find("temp"), "23\xc2\xb0" "C", 5), 0);
+	LCD_EXPECT_LINE(test, 3, "            23\xdf" "C");
+	KUNIT_EXPECT_EQ(test, lcd_field_set(lcd_field_find("temp"), "\xc2\xb0", 2), 0);
+	LCD_EXPECT_LINE(test, 3, "               \xdf");
+	KUNIT_EXPECT_EQ(test, lcd_field_remove("temp"), 0);
+
+	KUNIT_ASSERT_EQ(test, lcd_open(NULL, &f), 0);
+	preset.id = 4;
+	strcpy(preset.text, "\xe2\x86\x92 5\xc2\xb0" "C");
+	KUNIT_EXPECT_EQ(test, lcd_preset_set(&preset), 0);
+	KUNIT_EXPECT_EQ(test, lcd_preset_show(f.private_data, 4), 0);
+	LCD_EXPECT_LINE(test, 0, "\x7e 5\xdf" "C           ");
+	LCD_EXPECT_LINE(test, 1, "                ");
+	lcd_release(NULL, &f);
+	lcd.charset = saved;
+}
+
+static void lcd_test_busy_model(struct kunit *test)
+{
+	unsigned long polled;
+	int k;
+
+	// the same full screen redraw with and without the model, once it is
+	// confident the model should hardly ever need to poll the busy flag
+	for (k = 0; k < lcd.map->cells; k++)
+		lcd_test_print("#");
+	polled = lcd_test_sim.status_reads;
+
+	busy_model = 1;
+	lcd_sim_clear_stats(&lcd_test_sim);
+	for (k = 0; k < lcd.map->cells; k++)
+		lcd_test_print("*");
+
+	LCD_EXPECT_LINE(test, 0, "****************");
+	LCD_EXPECT_LINE(test, 3, "****************");
+	KUNIT_EXPECT_LT(test, lcd_test_sim.status_reads * 4, polled);
+	LCD_EXPECT_BUS(test, 436, 68, 64);
+}
+
+static void lcd_test_timing(struct kunit *test)
+{
+	// with execution times simulated nothing may reach the lcd while it
+	// is still busy, whether we poll or trust the model
+	lcd_test_sim.timing = true;
+	lcd_test_print("\eJpolled");
+	busy_model = 1;
+	lcd_test_print("\r\nmodelled modelled modelled");
+	lcd_test_sim.timing = false;
+
+	LCD_EXPECT_LINE(test, 0, "polled          ");
+	LCD_EXPECT_LINE(test, 1, "modelled modelle");
+	LCD_EXPECT_LINE(test, 2, "d modelled      ");
+	KUNIT_EXPECT_EQ(test, lcd_test_sim.violations, 0UL);
+}
+
+static void lcd_test_capture(struct kunit *test)
+{
+	unsigned int head, k;
+	unsigned long strobes = 0;
+
+	// every e strobe the lcd saw is in the capture ring
+	atomic_set(&lcd_capture.head, 0);
+	lcd_test_print("capture");
+	head = atomic_read(&lcd_capture.head);
+	KUNIT_ASSERT_LT(test, head, (unsigned int)LCD_CAPTURE_SIZE);
+	for (k = 0; k < head; k++)
+		if (!(lcd_capture.rec[k].a & LCD_CAPTURE_GET) && (lcd_capture.rec[k].b & E))
+			strobes++;
+	KUNIT_EXPECT_EQ(test, strobes, lcd_test_sim.nibbles);
+}
+
+#ifdef CONFIG_FAULT_INJECTION
+// make the next n checks of a fault fire (and none after)
+static void lcd_test_fault(struct fault_attr *attr, int n)
+{
+	attr->probability = n ? 100 : 0;
+	attr->interval = 1;
+	attr->verbose = 0;
+	atomic_set(&attr->times, n);
+}
+
+static void lcd_test_fault_recovery(struct kunit *test)
+{
+	struct fault_attr *faults[] = {&fail_lcd_flip, &fail_lcd_drop, &fail_lcd_dup};
+	unsigned long strobes;
+	int k;
+
+	// the read back after each char has to notice a bad nibble and put
+	// the lcd right again, and it must all show up in the accounting
+	for (k = 0; k < ARRAY_SIZE(faults); k++) {
+		lcd_test_print("\eJ");
+		memset(&lcd.recovery, 0, sizeof(lcd.recovery));
+		lcd_test_fault(faults[k], 1);
+		lcd_test_print("fault");
+		lcd_test_fault(faults[k], 0);
+
+		LCD_EXPECT_LINE(test, 0, "fault           ");
+		KUNIT_EXPECT_GE(test, lcd.recovery.events, 1UL);
+		KUNIT_EXPECT_EQ(test, lcd.recovery.failed, 0UL);
+		KUNIT_EXPECT_GT(test, lcd.recovery.strobes, 0UL);
+	}
+
+	// a nibble is duplicated once however often the fault fires
+	mutex_lock(&lcd.lock);
+	strobes = lcd.strobes;
+	lcd_test_fault(&fail_lcd_dup, -1);
+	lcd_bus_write4(&lcd, 1, ' ');
+	lcd_test_fault(&fail_lcd_dup, 0);
+	KUNIT_EXPECT_EQ(test, lcd.strobes - strobes, 2UL);
+	lcd_forget(&lcd);	// the two made a char we didn't account for
+
+	// and a recovery inside another is the one event
+	memset(&lcd.recovery, 0, sizeof(lcd.recovery));
+	lcd_recovery_begin(&lcd);
+	lcd_recovery_begin(&lcd);
+	lcd_recovery_end(&lcd, false);
+	lcd_recovery_end(&lcd, true);
+	KUNIT_EXPECT_EQ(test, lcd.recovery.events, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd.recovery.failed, 0UL);
+	mutex_unlock(&lcd.lock);
+}
+
+static void lcd_test_fault_busy(struct kunit *test)
+{
+	memset(&lcd.recovery, 0, sizeof(lcd.recovery));
+
+	// a busy flag stuck for a few polls is waited out
+	lcd_test_fault(&fail_lcd_busy, 3);
+	lcd_test_print("a");
+	KUNIT_EXPECT_EQ(test, lcd.recovery.events, 1UL);
+	KUNIT_EXPECT_EQ(test, lcd.recovery.busy_timeouts, 0UL);
+
+	// one stuck for longer times out, but the char still goes out
+	lcd_test_fault(&fail_lcd_busy, 6);
+	lcd_test_print("b");
+	lcd_test_fault(&fail_lcd_busy, 0);
+	KUNIT_EXPECT_EQ(test, lcd.recovery.busy_timeouts, 1UL);
+	LCD_EXPECT_LINE(test, 0, "ab              ");
+}
+#endif
+
+static struct kunit_case lcd_test_cases[] = {
+	KUNIT_CASE(lcd_test_hello),
+	KUNIT_CASE(lcd_test_gotoxy),
+	KUNIT_CASE(lcd_test_escapes),
+	KUNIT_CASE(lcd_test_am_wrap),
+	KUNIT_CASE(lcd_test_no_am),
+	KUNIT_CASE(lcd_test_control_chars),
+	KUNIT_CASE(lcd_test_tab_no_am),
+	KUNIT_CASE(lcd_test_geometry),
+	KUNIT_CASE(lcd_test_dual),
+	KUNIT_CASE(lcd_test_peephole),
+	KUNIT_CASE(lcd_test_lazy_cursor),
+	KUNIT_CASE(lcd_test_scrub),
+	KUNIT_CASE(lcd_test_frame),
+	KUNIT_CASE(lcd_test_panic),
+	KUNIT_CASE(lcd_test_console),
+	KUNIT_CASE(lcd_test_engine),
+	KUNIT_CASE(lcd_test_fields),
+	KUNIT_CASE(lcd_test_triggers),
+	KUNIT_CASE(lcd_test_anim),
+	KUNIT_CASE(lcd_test_writers),
+	KUNIT_CASE(lcd_test_presets),
+	KUNIT_CASE(lcd_test_utf8),
+	KUNIT_CASE(lcd_test_busy_model),
+	KUNIT_CASE(lcd_test_timing),
+	KUNIT_CASE(lcd_test_capture),
+#ifdef CONFIG_FAULT_INJECTION
+	KUNIT_CASE(lcd_test_fault_recovery),
+	KUNIT_CASE(lcd_test_fault_busy),
+#endif
+	{}
+};
+
+static struct kunit_suite lcd_test_suite = {
+	.name = "fls_lcd",
+	.init = lcd_test_init,
+	.exit = lcd_test_exit,
+	.test_cases = lcd_test_cases,
+};
+
+kunit_test_suite(lcd_test_suite);
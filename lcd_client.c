@@ -0,0 +1,515 @@
+/*
+ * FLS front panel lcd client library
+ *
+ * See lcd_client.h. The frame is kept as cells numbered left to right, top to
+ * bottom, which is also how the driver moves its cursor with am on: \eC and
+ * \eD step one cell, \n and \eA a line (wrapping round the screen), \r goes
+ * to the start of the line and \eH to the first cell. The driver only sends
+ * the lcd an address for where the next char goes however it got there, so a
+ * move costs one command on the bus whatever escapes it took, and the library
+ * just picks the fewest bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "fls_lcd_ioctl.h"
+#include "lcd_client.h"
+
+#define LCD_CLIENT_DEV      "/dev/lcd"
+#define LCD_CLIENT_GEOMETRY "/sys/class/lcd/lcd/geometry"
+#define LCD_CLIENT_GLYPHS   "/sys/class/lcd/lcd/glyphs"
+#define LCD_CLIENT_MAX_COLS  (40)
+#define LCD_CLIENT_MAX_LINES (4)
+#define LCD_CLIENT_MAX_CELLS (LCD_CLIENT_MAX_COLS * LCD_CLIENT_MAX_LINES)
+#define LCD_CLIENT_TEXT      (4 * LCD_CLIENT_MAX_COLS + 1)	// utf-8 for a line
+#define LCD_CLIENT_ROM(code) (0xf000 | (code))			// the rom's own code
+
+struct lcd_client_field {
+	int cell;
+	int width;
+	enum lcd_client_align align;
+};
+
+struct lcd_client {
+	int fd;
+	int cols;
+	int lines;
+	int cells;
+	int utf8;				// the driver decodes utf-8
+
+	// cells are code points, as the driver will have decoded them
+	uint32_t frame[LCD_CLIENT_MAX_CELLS];	// being drawn
+	uint32_t shown[LCD_CLIENT_MAX_CELLS];	// on the lcd as of the last commit
+	int valid;				// shown is known
+	int am;					// the driver has been put in am
+	int cursor;				// cell the driver's cursor is on
+
+	uint32_t preset[LCD_PRESETS][LCD_CLIENT_MAX_CELLS];	// as given to the driver
+	unsigned int presets;				// bit per one given
+
+	struct lcd_client_field field[LCD_CLIENT_FIELDS];
+	int fields;
+
+	char *out;				// a commit's bytes
+	struct lcd_client_stats stats;
+};
+
+static uint64_t lcd_client_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the driver's geometry attribute, or its default when that can't be read
+static void lcd_client_geometry(char *buf, size_t len)
+{
+	FILE *f;
+
+	snprintf(buf, len, "16x4");
+	f = fopen(LCD_CLIENT_GEOMETRY, "r");
+	if (!f)
+		return;
+	if (!fgets(buf, len, f))
+		snprintf(buf, len, "16x4");
+	fclose(f);
+}
+
+// whether the driver decodes utf-8, from its glyphs attribute ("rom a00 utf8
+// on"), it does by default
+static int lcd_client_utf8(void)
+{
+	char buf[64];
+	FILE *f;
+	int on = 1;
+
+	f = fopen(LCD_CLIENT_GLYPHS, "r");
+	if (!f)
+		return on;
+	if (fgets(buf, sizeof(buf), f) && strstr(buf, "utf8 off"))
+		on = 0;
+	fclose(f);
+	return on;
+}
+
+static struct lcd_client *lcd_client_new(const char *path, int flags, const char *geometry)
+{
+	struct lcd_client *c;
+	char geo[16];
+	int cols, lines;
+
+	if (!geometry) {
+		lcd_client_geometry(geo, sizeof(geo));
+		geometry = geo;
+	}
+	if (sscanf(geometry, "%dx%d", &cols, &lines) != 2 ||
+	    cols < 1 || cols > LCD_CLIENT_MAX_COLS || lines < 1 || lines > LCD_CLIENT_MAX_LINES) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	c->cols = cols;
+	c->lines = lines;
+	c->cells = cols * lines;
+	c->utf8 = lcd_client_utf8();
+
+	// the most a commit can take is a move to every other cell, a move being
+	// at worst home, down to the line and across to the column, and a char
+	// of up to 4 bytes
+	c->out = malloc(4 + c->cells * (5 + lines + 2 * cols));
+	if (!c->out)
+		goto fail;
+
+	c->fd = open(path, flags, 0644);
+	if (c->fd < 0)
+		goto fail;
+
+	lcd_client_clear(c);
+	lcd_client_invalidate(c);
+	return c;
+
+fail:
+	free(c->out);
+	free(c);
+	return NULL;
+}
+
+struct lcd_client *lcd_client_open(const char *dev, const char *geometry)
+{
+	return lcd_client_new(dev ? dev : LCD_CLIENT_DEV, O_WRONLY, geometry);
+}
+
+struct lcd_client *lcd_client_capture(const char *path, const char *geometry)
+{
+	return lcd_client_new(path, O_WRONLY | O_CREAT | O_TRUNC, geometry);
+}
+
+void lcd_client_close(struct lcd_client *c)
+{
+	if (!c)
+		return;
+	close(c->fd);
+	free(c->out);
+	free(c);
+}
+
+int lcd_client_cols(const struct lcd_client *c)
+{
+	return c->cols;
+}
+
+int lcd_client_lines(const struct lcd_client *c)
+{
+	return c->lines;
+}
+
+static void lcd_client_blank(uint32_t *cells, int count)
+{
+	while (count--)
+		*cells++ = ' ';
+}
+
+void lcd_client_clear(struct lcd_client *c)
+{
+	lcd_client_blank(c->frame, c->cells);
+}
+
+// the next char of *s, moving it on, decoded as the driver does: a sequence
+// that is overlong, a surrogate, past unicode or cut off is its bytes, each
+// the rom's own code
+static uint32_t lcd_client_next(const struct lcd_client *c, const char **s)
+{
+	static const uint32_t least[] = {0, 0, 0x80, 0x800, 0x10000};
+	const unsigned char *p = (const unsigned char *)*s;
+	uint32_t cp;
+	int want, k;
+
+	want = !c->utf8 || *p < 0xc2 || *p > 0xf4 ? 1 : *p >= 0xf0 ? 4 : *p >= 0xe0 ? 3 : 2;
+	cp = *p & (0x3f >> (want - 1));
+	for (k = 1; k < want && (p[k] & 0xc0) == 0x80; k++)
+		cp = cp << 6 | (p[k] & 0x3f);
+	if (want == 1 || k < want || cp < least[want] || (cp >= 0xd800 && cp < 0xe000) || cp > 0x10ffff) {
+		// a byte on its own, any a broken sequence took are each
+		// looked at again
+		*s += 1;
+		return *p < 0x80 ? *p : LCD_CLIENT_ROM(*p);
+	}
+	*s += want;
+	return cp;
+}
+
+// the cells s takes, up to max
+static int lcd_client_len(const struct lcd_client *c, const char *s, int max)
+{
+	int n;
+
+	for (n = 0; *s && n < max; n++)
+		lcd_client_next(c, &s);
+	return n;
+}
+
+// chars the driver would take as a control (or the end of the write) are
+// drawn as spaces, 0x01-0x07 are the custom chars so they go through
+static uint32_t lcd_client_char(uint32_t cp)
+{
+	if (cp < 0x20 && (cp == 0 || cp > 0x07))
+		return ' ';
+	return cp;
+}
+
+static void lcd_client_put(struct lcd_client *c, int x, int y, const char *s, int len)
+{
+	uint32_t cp;
+	int k;
+
+	if (y < 0 || y >= c->lines)
+		return;
+	for (k = 0; *s && k < len && x + k < c->cols; k++) {
+		cp = lcd_client_next(c, &s);
+		if (x + k >= 0)
+			c->frame[y * c->cols + x + k] = lcd_client_char(cp);
+	}
+}
+
+void lcd_client_puts(struct lcd_client *c, int x, int y, const char *s)
+{
+	lcd_client_put(c, x, y, s, c->cols - x);
+}
+
+void lcd_client_printf(struct lcd_client *c, int x, int y, const char *fmt, ...)
+{
+	char buf[LCD_CLIENT_TEXT];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	lcd_client_puts(c, x, y, buf);
+}
+
+int lcd_client_field(struct lcd_client *c, int x, int y, int width, enum lcd_client_align align)
+{
+	struct lcd_client_field *f;
+
+	if (c->fields == LCD_CLIENT_FIELDS || x < 0 || y < 0 || y >= c->lines ||
+	    width < 1 || x + width > c->cols)
+		return -1;
+
+	f = &c->field[c->fields];
+	f->cell = y * c->cols + x;
+	f->width = width;
+	f->align = align;
+	lcd_client_blank(c->frame + f->cell, width);
+	return c->fields++;
+}
+
+void lcd_client_set(struct lcd_client *c, int field, const char *fmt, ...)
+{
+	struct lcd_client_field *f;
+	char buf[LCD_CLIENT_TEXT];
+	va_list ap;
+	int len, pad;
+
+	if (field < 0 || field >= c->fields)
+		return;
+	f = &c->field[field];
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	len = lcd_client_len(c, buf, f->width);
+
+	switch (f->align) {
+		case LCD_ALIGN_RIGHT:
+			pad = f->width - len;
+			break;
+		case LCD_ALIGN_CENTER:
+			pad = (f->width - len) / 2;
+			break;
+		default:
+			pad = 0;
+			break;
+	}
+	lcd_client_blank(c->frame + f->cell, f->width);
+	lcd_client_put(c, f->cell % c->cols + pad, f->cell / c->cols, buf, len);
+}
+
+// the bytes that make the driver show cp, utf-8 unless it puts bytes as they
+// are (when a cell can only be a byte)
+static int lcd_client_encode(const struct lcd_client *c, char *p, uint32_t cp)
+{
+	if (cp < 0x80 || !c->utf8) {
+		p[0] = cp & 0xff;
+		return 1;
+	}
+	if (cp < 0x800) {
+		p[0] = 0xc0 | cp >> 6;
+		p[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+	if (cp < 0x10000) {
+		p[0] = 0xe0 | cp >> 12;
+		p[1] = 0x80 | (cp >> 6 & 0x3f);
+		p[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	p[0] = 0xf0 | cp >> 18;
+	p[1] = 0x80 | (cp >> 12 & 0x3f);
+	p[2] = 0x80 | (cp >> 6 & 0x3f);
+	p[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+static int lcd_client_repeat(char *p, const char *s, int n)
+{
+	int l = strlen(s);
+	int k;
+
+	for (k = 0; k < n; k++)
+		memcpy(p + k * l, s, l);
+	return n * l;
+}
+
+// lines from y0 to y, as \n wraps from the last line to the first going up
+// can be quicker by going down
+static int lcd_client_vert(struct lcd_client *c, int y0, int y, int *up)
+{
+	int down = (y - y0 + c->lines) % c->lines;
+
+	*up = (y0 - y + c->lines) % c->lines;
+	if (2 * *up < down)
+		return 2 * *up;
+	*up = 0;
+	return down;
+}
+
+// the fewest bytes that take the driver's cursor from cell from (-1 for not
+// known) to cell to: from where it is, the start of its line (\r) or the
+// first cell (\eH), down or up to the line then across, or from the start of
+// the next line back (\eD wraps to the end of the line before)
+static int lcd_client_move(struct lcd_client *c, char *p, int from, int to)
+{
+	static const char *prefix[] = {"", "\r", "\eH"};
+	int tx = to % c->cols, ty = to / c->cols;
+	int o, x0, y0, y, dx, up, cost;
+	int best = -1, best_o = 0, best_y = 0, best_up = 0, best_dx = 0;
+	int n = 0;
+
+	for (o = from < 0 ? 2 : 0; o < 3; o++) {
+		x0 = o == 0 ? from % c->cols : 0;
+		y0 = o == 2 ? 0 : from / c->cols;
+		for (y = ty; y <= ty + (x0 == 0); y++) {
+			dx = y == ty ? tx - x0 : tx - c->cols;
+			cost = strlen(prefix[o]) + lcd_client_vert(c, y0, y % c->lines, &up) + 2 * abs(dx);
+			if (best < 0 || cost < best) {
+				best = cost;
+				best_o = o;
+				best_y = y % c->lines;
+				best_up = up;
+				best_dx = dx;
+			}
+		}
+	}
+
+	n += lcd_client_repeat(p + n, prefix[best_o], 1);
+	y0 = best_o == 2 ? 0 : from / c->cols;
+	if (best_up)
+		n += lcd_client_repeat(p + n, "\eA", best_up);
+	else
+		n += lcd_client_repeat(p + n, "\n", (best_y - y0 + c->lines) % c->lines);
+	n += lcd_client_repeat(p + n, best_dx < 0 ? "\eD" : "\eC", abs(best_dx));
+	return n;
+}
+
+int lcd_client_commit(struct lcd_client *c)
+{
+	int start, end, k, sent = 0, n = 0;
+	uint64_t t;
+	ssize_t ret;
+
+	// the moves count on the cursor wrapping onto the next line
+	if (!c->am)
+		n += sprintf(c->out + n, "\em");
+
+	// an unknown lcd is cleared, then only what isn't a space is drawn
+	if (!c->valid) {
+		n += sprintf(c->out + n, "\eJ");
+		lcd_client_blank(c->shown, c->cells);
+		c->cursor = 0;
+	}
+
+	for (start = 0; start < c->cells; start = end) {
+		if (c->frame[start] == c->shown[start]) {
+			end = start + 1;
+			continue;
+		}
+
+		// a run of changes, one unchanged cell between two is written
+		// over (a char costs the lcd about what moving past it does)
+		for (end = start + 1; end < c->cells; end++) {
+			if (c->frame[end] != c->shown[end])
+				continue;
+			if (end + 1 < c->cells && c->frame[end + 1] != c->shown[end + 1])
+				continue;
+			break;
+		}
+
+		if (c->cursor != start)
+			n += lcd_client_move(c, c->out + n, c->cursor, start);
+		for (k = start; k < end; k++) {
+			n += lcd_client_encode(c, c->out + n, c->frame[k]);
+			sent += c->frame[k] != c->shown[k];
+		}
+		c->cursor = end % c->cells;
+	}
+
+	if (!n)
+		return 0;
+
+	t = lcd_client_ns();
+	ret = write(c->fd, c->out, n);
+	t = lcd_client_ns() - t;
+	if (ret != n) {
+		// no telling what made it so start again next time
+		lcd_client_invalidate(c);
+		if (ret >= 0)
+			errno = EIO;
+		return -1;
+	}
+
+	memcpy(c->shown, c->frame, c->cells * sizeof(c->frame[0]));
+	c->valid = 1;
+	c->am = 1;
+	c->stats.commits++;
+	c->stats.cells += sent;
+	c->stats.bytes += n;
+	c->stats.last_ns = t;
+	c->stats.total_ns += t;
+	if (t > c->stats.max_ns)
+		c->stats.max_ns = t;
+	return sent;
+}
+
+int lcd_client_preset(struct lcd_client *c, unsigned int id)
+{
+	struct lcd_preset preset = {.id = id};
+	int k, n = 0;
+
+	if (id >= LCD_PRESETS) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (k = 0; k < c->cells; k++)
+		n += lcd_client_encode(c, preset.text + n, c->frame[k]);
+	if (ioctl(c->fd, LCD_IOC_PRESET_SET, &preset) < 0)
+		return -1;
+	memcpy(c->preset[id], c->frame, c->cells * sizeof(c->frame[0]));
+	c->presets |= 1 << id;
+	return 0;
+}
+
+int lcd_client_preset_show(struct lcd_client *c, unsigned int id)
+{
+	__u32 i = id;
+
+	if (id >= LCD_PRESETS || !(c->presets & (1 << id))) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (ioctl(c->fd, LCD_IOC_PRESET_SHOW, &i) < 0)
+		return -1;
+
+	// the lcd is the preset now whatever was on it
+	memcpy(c->frame, c->preset[id], c->cells * sizeof(c->frame[0]));
+	memcpy(c->shown, c->preset[id], c->cells * sizeof(c->frame[0]));
+	c->valid = 1;
+	return 0;
+}
+
+int lcd_client_weight(struct lcd_client *c, unsigned int weight)
+{
+	__u32 w = weight;
+
+	return ioctl(c->fd, LCD_IOC_WEIGHT, &w);
+}
+
+void lcd_client_invalidate(struct lcd_client *c)
+{
+	c->valid = 0;
+	c->cursor = -1;
+}
+
+const struct lcd_client_stats *lcd_client_stats(const struct lcd_client *c)
+{
+	return &c->stats;
+}
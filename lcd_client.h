@@ -0,0 +1,73 @@
+/*
+ * FLS front panel lcd client library
+ *
+ * Draw into an off-screen frame, then commit it. A commit compares the frame
+ * with what the library last sent and writes only the cells that changed,
+ * with cursor escapes in between, as one write() to the driver. Fields are
+ * fixed places on the frame that a value is formatted into (padded and
+ * aligned, so a shorter value doesn't leave old chars behind).
+ *
+ * Text is utf-8 and a cell is a char, decoded as the driver does (when its
+ * utf8 is on, see its glyphs attribute): a code point the rom has is its char,
+ * U+F000-U+F0FF is the rom's own code (the low byte) and a byte that isn't
+ * utf-8 stands for that code. With the driver's utf8 off a byte is a cell.
+ *
+ * The library takes over the device: it assumes nothing else writes to it
+ * between commits (lcd_client_invalidate() after something has).
+ */
+#ifndef LCD_CLIENT_H
+#define LCD_CLIENT_H
+
+#include <stdint.h>
+
+#define LCD_CLIENT_FIELDS (32)
+
+enum lcd_client_align {LCD_ALIGN_LEFT, LCD_ALIGN_RIGHT, LCD_ALIGN_CENTER};
+
+struct lcd_client_stats {
+	unsigned long commits;	// that had something to send
+	unsigned long cells;	// changed cells sent
+	unsigned long bytes;	// written, chars and escapes
+	uint64_t last_ns;	// the last commit's write()
+	uint64_t max_ns;
+	uint64_t total_ns;
+};
+
+struct lcd_client;
+
+// dev NULL for /dev/lcd, geometry "16x4" etc or NULL for the driver's (from
+// its sysfs geometry attribute)
+struct lcd_client *lcd_client_open(const char *dev, const char *geometry);
+// commits go to a new file at path instead, to replay with lcd_replay (the
+// preset and weight ioctls fail)
+struct lcd_client *lcd_client_capture(const char *path, const char *geometry);
+void lcd_client_close(struct lcd_client *c);
+int lcd_client_cols(const struct lcd_client *c);
+int lcd_client_lines(const struct lcd_client *c);
+
+// frame drawing, text is clipped at the end of its line
+void lcd_client_clear(struct lcd_client *c);
+void lcd_client_puts(struct lcd_client *c, int x, int y, const char *s);
+void lcd_client_printf(struct lcd_client *c, int x, int y, const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+// a field is a handle for width cells at x,y, -1 if it doesn't fit or there
+// are too many
+int lcd_client_field(struct lcd_client *c, int x, int y, int width, enum lcd_client_align align);
+void lcd_client_set(struct lcd_client *c, int field, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+// send what changed in one write(), returns the cells sent or -1 (errno set)
+int lcd_client_commit(struct lcd_client *c);
+// keep the frame in the driver as preset id (0-15), showing it later sends
+// only what differs from the lcd and leaves it as the frame
+int lcd_client_preset(struct lcd_client *c, unsigned int id);
+int lcd_client_preset_show(struct lcd_client *c, unsigned int id);
+
+// this client's share of the bus against other writers (default 100)
+int lcd_client_weight(struct lcd_client *c, unsigned int weight);
+// the next commit redraws the whole frame
+void lcd_client_invalidate(struct lcd_client *c);
+const struct lcd_client_stats *lcd_client_stats(const struct lcd_client *c);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * FLS front panel lcd client library check
+ *
+ * Draws random frames with the client library on every geometry, captures
+ * what each commit writes and runs it through the print engine on the mock
+ * bus (see lcd_host.h), and fails if the lcd ever differs from the frame or
+ * the engine's cursor from the lcd's. Half the runs decode utf-8 as the
+ * driver does by default, half put bytes as they are.
+ *
+ *   make lcd_client_check && ./lcd_client_check [-n frames] [-s seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "lcd_host.h"
+
+// built in so the check can see the frame it drew
+#include "lcd_client.c"
+
+// text pieces, some plain and some the decoding has to get right: the rom's
+// chars, one it doesn't have, a byte that isn't utf-8, a direct code, cut
+// off and broken sequences, a custom char and a control
+static const char *pieces[] = {
+	"a", "Z", "7", " ", ":", "\xc2\xb0", "\xe2\x86\x92", "\xe2\x99\xa5", "\xff",
+	"\xef\x83\xa4", "\xe2\x86", "\xc3(", "\x01", "\x1b",
+};
+
+#define PIECES (sizeof(pieces) / sizeof(pieces[0]))
+
+static void random_text(char *s, int max)
+{
+	int k, n = rand() % max + 1;
+
+	s[0] = 0;
+	for (k = 0; k < n; k++)
+		strcat(s, rand() % 3 ? pieces[rand() % 5] : pieces[rand() % PIECES]);
+}
+
+// the code the lcd should show for cell k of the frame
+static char want_code(const struct lcd_client *c, const struct lcd_t *lcd, int k)
+{
+	return c->utf8 ? lcd_charset_code(lcd->charset, c->frame[k]) : c->frame[k];
+}
+
+// returns the frames that came out wrong
+static int check(const char *geometry, int utf8, int frames, const char *path)
+{
+	static char buf[1 << 16];
+	struct lcd_client *c;
+	struct lcd_t lcd;
+	const char *err;
+	char text[64], line[LCD_MAX_COLS + 1];
+	int fd, field, n, k, x, y, bad = 0;
+	ssize_t len;
+
+	c = lcd_client_capture(path, geometry);
+	fd = open(path, O_RDONLY);
+	if (!c || fd < 0 || lcd_host_init(&lcd, geometry)) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	c->utf8 = utf8;
+	lcd_host_charset(&lcd, utf8 ? "a00" : NULL);
+	field = lcd_client_field(c, c->cols - 6, c->lines - 1, 6, LCD_ALIGN_RIGHT);
+
+	for (n = 0; n < frames; n++) {
+		for (k = rand() % 6; k; k--) {
+			random_text(text, 5);
+			lcd_client_puts(c, rand() % (c->cols + 2) - 2, rand() % c->lines, text);
+		}
+		random_text(text, 3);
+		lcd_client_set(c, field, "%d%s", rand() % 1000, text);
+		if (rand() % 50 == 0)
+			lcd_client_clear(c);
+		if (rand() % 200 == 0)
+			lcd_client_invalidate(c);
+		if (lcd_client_commit(c) < 0) {
+			perror("commit");
+			exit(EXIT_FAILURE);
+		}
+
+		while ((len = read(fd, buf, sizeof(buf))) > 0)
+			lcd_host_print(&lcd, buf, len);
+
+		err = lcd_host_check(&lcd);
+		for (y = 0; y < c->lines; y++) {
+			lcd_host_line(&lcd, y, line);
+			for (x = 0; x < c->cols && line[x] == want_code(c, &lcd, y * c->cols + x); x++)
+				;
+			if (x < c->cols && !err)
+				err = "lcd differs from the frame";
+		}
+		if (err && bad++ < 5)
+			fprintf(stderr, "%s utf8 %d frame %d: %s\n", geometry, utf8, n, err);
+	}
+
+	printf("%-6s utf8 %d %6d frames %8lu cells %8lu bytes %8lu commands %s\n", geometry, utf8, frames,
+		c->stats.cells, c->stats.bytes, lcd_host_cmds(&lcd), bad ? "FAILED" : "ok");
+	lcd_client_close(c);
+	close(fd);
+	return bad;
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/lcd_client_check.XXXXXX";
+	const char *geometry;
+	int frames = 2000, seed = 1;
+	int k, utf8, fd, opt, bad = 0;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+			case 'n': frames = atoi(optarg); break;
+			case 's': seed = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n frames] [-s seed]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	srand(seed);
+	for (utf8 = 1; utf8 >= 0; utf8--)
+		for (k = 0; (geometry = lcd_host_geometry(k)); k++)
+			bad += check(geometry, utf8, frames, path);
+
+	unlink(path);
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
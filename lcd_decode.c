@@ -0,0 +1,318 @@
+/*
+ * FLS front panel lcd bus capture decoder
+ *
+ * Turns a snapshot of the driver's capture ring (debugfs fls_lcd/capture)
+ * back into e strobes, nibbles and HD44780 commands, and checks the pin
+ * timing against the datasheet constants the driver uses.
+ *
+ *   cat /sys/kernel/debug/fls_lcd/capture > capture.bin
+ *   lcd_decode capture.bin
+ *
+ * The timestamps are only as fine as the kernel clocksource, pass its
+ * resolution with -r so intervals it can't resolve are not reported as
+ * violations. The decoder assumes the capture starts in 4 bit mode unless
+ * it sees the lcd powered up. On a 40x4 the second controller's commands
+ * (strobed by e2) are marked [e2].
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// hw layout (as fls_lcd.c)
+#define RS	(1 << 6)
+#define RW	(1 << 7)
+#define E	(1 << 8)
+#define E2	(1 << 10)
+#define D4	(1 << 0)
+#define D5	(1 << 1)
+#define D6	(1 << 4)
+#define D7	(1 << 5)
+#define PWR	(1 << 9)
+#define DATA	(D4 | D5 | D6 | D7)
+
+// bus timing in ns (as fls_lcd.c)
+#define Tc        (500)
+#define Tpw       (230)
+#define Tsp1      (40)
+#define Tsp2      (80)
+#define Td        (120)
+
+// capture format (as fls_lcd.c)
+#define LCD_CAPTURE_GET     (0x8000)
+#define LCD_CAPTURE_MAGIC   (0x43534c46)
+#define LCD_CAPTURE_VERSION (1)
+
+struct lcd_capture_rec {
+	uint32_t ts;
+	uint16_t a;
+	uint16_t b;
+};
+
+struct lcd_capture_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t count;
+	uint32_t lost;
+	uint64_t tn;
+};
+
+static const unsigned int e_line[2] = {E, E2};
+
+enum violation {V_TSP1, V_TPW, V_TSP2, V_TC, V_TD, V_COUNT};
+static const char *violation_name[V_COUNT] = {"tsp1", "tpw", "tsp2", "tc", "td"};
+static const int violation_min[V_COUNT] = {Tsp1, Tpw, Tsp2, Tc, Td};
+
+// each controller (e line) pairs up its own nibbles
+struct ctrl {
+	int64_t t_rise;		// last e rise
+	int64_t t_prev_rise;
+	int four_bit;
+	int half;		// next nibble is the low one
+	uint8_t byte;
+	unsigned int byte_rs;	// rs of the high nibble
+};
+
+struct decoder {
+	int64_t res;		// clock resolution, ns
+	int quiet;
+
+	unsigned int pins;
+	unsigned int known;	// pins we have seen driven
+	int64_t t_ctl;		// last rs/rw change
+	int64_t t_data;		// last data line change
+	uint8_t read;		// nibble read while e was high
+	struct ctrl c[2];
+
+	unsigned long strobes, cmds, data_writes, reads, splits;
+	unsigned long violations[V_COUNT];
+};
+
+static uint8_t nibble(unsigned int pins)
+{
+	return (pins & D4 ? 1 : 0) | (pins & D5 ? 2 : 0) | (pins & D6 ? 4 : 0) | (pins & D7 ? 8 : 0);
+}
+
+static void check(struct decoder *d, int64_t t, enum violation v, int64_t dt)
+{
+	if (dt + d->res >= violation_min[v])
+		return;
+	d->violations[v]++;
+	if (!d->quiet)
+		printf("%12.3f us   VIOLATION %s %lld ns < %d ns\n",
+			t / 1e3, violation_name[v], (long long)dt, violation_min[v]);
+}
+
+static const char *cmd_name(uint8_t db)
+{
+	if (db & 0x80)
+		return "set dram address";
+	if (db & 0x40)
+		return "set cgram address";
+	if (db & 0x20)
+		return "function set";
+	if (db & 0x10)
+		return "shift";
+	if (db & 0x08)
+		return "display control";
+	if (db & 0x04)
+		return "entry mode";
+	if (db & 0x02)
+		return "home";
+	if (db & 0x01)
+		return "clear";
+	return "nop";
+}
+
+static void byte_done(struct decoder *d, int k, int64_t t, unsigned int rs, unsigned int rw, uint8_t db)
+{
+	const char *who = k ? "[e2] " : "";
+
+	if (rw) {
+		d->reads++;
+		if (!d->quiet) {
+			if (rs)
+				printf("%12.3f us   %sread data 0x%.2x\n", t / 1e3, who, db);
+			else
+				printf("%12.3f us   %sread busy %d ac 0x%.2x\n", t / 1e3, who, db >> 7, db & 0x7f);
+		}
+		return;
+	}
+
+	if (rs) {
+		d->data_writes++;
+		if (!d->quiet)
+			printf("%12.3f us   %sdata 0x%.2x '%c'\n", t / 1e3, who, db, db >= 0x20 && db < 0x7f ? db : '.');
+		return;
+	}
+
+	d->cmds++;
+	if (!d->quiet)
+		printf("%12.3f us   %scmd 0x%.2x %s\n", t / 1e3, who, db, cmd_name(db));
+	if ((db & 0xe0) == 0x20)
+		d->c[k].four_bit = !(db & 0x10);
+}
+
+static void strobe(struct decoder *d, int k, int64_t t, unsigned int pins)
+{
+	struct ctrl *c = &d->c[k];
+	unsigned int rs = pins & RS;
+	unsigned int rw = pins & RW;
+	uint8_t n = rw ? d->read : nibble(pins);
+
+	d->strobes++;
+	if (!c->four_bit) {
+		// 8 bit mode, only the high nibble is wired up
+		byte_done(d, k, t, rs, rw, n << 4);
+		return;
+	}
+
+	if (!c->half) {
+		c->byte = n << 4;
+		c->byte_rs = rs;
+		c->half = 1;
+		return;
+	}
+
+	// a byte whose nibbles disagree on rs is most likely a nibble slip
+	// or the driver resyncing after one
+	if (c->byte_rs != rs) {
+		d->splits++;
+		if (!d->quiet)
+			printf("%12.3f us   SPLIT rs changed between nibbles, pairing is off\n", t / 1e3);
+		c->byte = n << 4;
+		c->byte_rs = rs;
+		return;
+	}
+	c->half = 0;
+	byte_done(d, k, t, rs, rw, c->byte | n);
+}
+
+static void set(struct decoder *d, int64_t t, unsigned int set, unsigned int clear)
+{
+	unsigned int mask = set | clear;
+	unsigned int pins = (d->pins | set) & ~clear;
+	unsigned int changed = ((pins ^ d->pins) & d->known) | (mask & ~d->known);
+	struct ctrl *c;
+	int k;
+
+	d->known |= mask;
+	if (changed & pins & PWR) {
+		if (!d->quiet)
+			printf("%12.3f us   power on\n", t / 1e3);
+		for (k = 0; k < 2; k++) {
+			d->c[k].four_bit = 0;
+			d->c[k].half = 0;
+		}
+	}
+	if (changed & (RS | RW))
+		d->t_ctl = t;
+	if (changed & DATA)
+		d->t_data = t;
+
+	for (k = 0; k < 2; k++) {
+		c = &d->c[k];
+		if (changed & pins & e_line[k]) {
+			check(d, t, V_TSP1, t - d->t_ctl);
+			if (c->t_prev_rise)
+				check(d, t, V_TC, t - c->t_prev_rise);
+			c->t_rise = t;
+			c->t_prev_rise = t;
+		}
+		if (changed & d->pins & e_line[k]) {
+			check(d, t, V_TPW, t - c->t_rise);
+			if (!(pins & RW))
+				check(d, t, V_TSP2, t - d->t_data);
+			strobe(d, k, t, d->pins);
+		}
+	}
+
+	d->pins = pins;
+}
+
+static void get(struct decoder *d, int64_t t, unsigned int mask, unsigned int value)
+{
+	if (!(mask & DATA) || !(d->pins & (E | E2)))
+		return;
+	check(d, t, V_TD, t - d->c[d->pins & E ? 0 : 1].t_rise);
+	d->read = nibble(value);
+}
+
+int main(int argc, char **argv)
+{
+	struct decoder d = {0};
+	struct lcd_capture_hdr hdr;
+	struct lcd_capture_rec *rec;
+	int64_t *ts;
+	FILE *f;
+	int k, opt;
+
+	d.c[0].four_bit = 1;
+	d.c[1].four_bit = 1;
+	while ((opt = getopt(argc, argv, "r:q")) != -1) {
+		switch (opt) {
+			case 'r': d.res = atoll(optarg); break;
+			case 'q': d.quiet = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-r clock_res_ns] [-q] capture.bin\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-r clock_res_ns] [-q] capture.bin\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != LCD_CAPTURE_MAGIC) {
+		fprintf(stderr, "%s is not an lcd capture (or from a machine of the other byte order)\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if (hdr.version != LCD_CAPTURE_VERSION || hdr.rec_size != sizeof(*rec)) {
+		fprintf(stderr, "unsupported capture version %d\n", hdr.version);
+		return EXIT_FAILURE;
+	}
+
+	rec = calloc(hdr.count + 1, sizeof(*rec));
+	ts = calloc(hdr.count + 1, sizeof(*ts));
+	if (!rec || !ts || fread(rec, sizeof(*rec), hdr.count, f) != hdr.count) {
+		fprintf(stderr, "short capture\n");
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+
+	// only the newest timestamp is complete, work back from it
+	// (assumes no two records are more than 4.29s apart)
+	if (hdr.count)
+		ts[hdr.count - 1] = hdr.tn;
+	for (k = (int)hdr.count - 2; k >= 0; k--)
+		ts[k] = ts[k + 1] - (uint32_t)(rec[k + 1].ts - rec[k].ts);
+
+	for (k = 0; k < hdr.count; k++) {
+		int64_t t = ts[k] - ts[0];
+
+		if (rec[k].a & LCD_CAPTURE_GET)
+			get(&d, t, rec[k].a & ~LCD_CAPTURE_GET, rec[k].b);
+		else
+			set(&d, t, rec[k].a, rec[k].b);
+	}
+
+	printf("records %u lost %u span %.3f us\n", hdr.count, hdr.lost,
+		hdr.count ? (ts[hdr.count - 1] - ts[0]) / 1e3 : 0.0);
+	printf("strobes %lu cmds %lu data_writes %lu reads %lu splits %lu\n",
+		d.strobes, d.cmds, d.data_writes, d.reads, d.splits);
+	printf("violations");
+	for (k = 0; k < V_COUNT; k++)
+		printf(" %s %lu", violation_name[k], d.violations[k]);
+	printf("\n");
+
+	free(rec);
+	free(ts);
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * FLS front panel lcd print engine fuzzer (libFuzzer)
+ *
+ * Feeds arbitrary write streams through the engine on the mock bus and
+ * aborts if the cursor ever ends up somewhere the driver can't handle or out
+ * of step with the lcd's address counter. The first byte of the input picks
+ * how the rest is split into writes, so escapes split across writes get
+ * covered too, its next three bits the panel geometry and its top bit whether
+ * utf-8 is decoded.
+ *
+ *   make lcd_fuzz && ./lcd_fuzz -max_len=256
+ *
+ * Built with -DLCD_FUZZ_MAIN instead it just runs the files given on the
+ * command line, to replay a crash without libFuzzer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "lcd_host.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct lcd_t lcd;
+	const char *err;
+	size_t l, n, chunk;
+
+	if (size < 1)
+		return 0;
+	chunk = data[0] % 16 + 1;
+	lcd_host_init(&lcd, lcd_host_geometry(data[0] / 16 % 8));
+	if (data[0] & 0x80)
+		lcd_host_charset(&lcd, "a00");
+	data++;
+	size--;
+
+	for (l = 0; l < size; l += n) {
+		n = size - l < chunk ? size - l : chunk;
+		lcd_host_print(&lcd, (const char *)data + l, n);
+		err = lcd_host_check(&lcd);
+		if (err) {
+			fprintf(stderr, "%s (%s pos 0x%.2x ac 0x%.2x 0x%.2x am %d) after %zu bytes\n",
+				err, lcd.map->geo->name, lcd.pos, lcd.ac[0], lcd.ac[1], lcd.am, l + n);
+			abort();
+		}
+	}
+
+	return 0;
+}
+
+#ifdef LCD_FUZZ_MAIN
+int main(int argc, char **argv)
+{
+	static uint8_t buf[1 << 16];
+	FILE *f;
+	size_t n;
+	int k;
+
+	for (k = 1; k < argc; k++) {
+		f = fopen(argv[k], "rb");
+		if (!f) {
+			perror(argv[k]);
+			return EXIT_FAILURE;
+		}
+		n = fread(buf, 1, sizeof(buf), f);
+		fclose(f);
+		LLVMFuzzerTestOneInput(buf, n);
+	}
+
+	return 0;
+}
+#endif
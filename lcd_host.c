@@ -0,0 +1,159 @@
+/*
+ * FLS front panel lcd print engine, host build (see lcd_host.h)
+ */
+#include <stdio.h>
+#include <string.h>
+#include "lcd_host.h"
+
+#define KERN_ERR     ""
+#define KERN_WARNING ""
+#define printk(...) ((void)(lcd_host_verbose && fprintf(stderr, __VA_ARGS__)))
+
+int lcd_host_verbose;
+
+// bit 7 of an address picks the controller, as in the driver
+static void lcd_set_dram_addr(struct lcd_t *lcd, uint8_t addr)
+{
+	lcd->stats.addr++;
+	lcd->ac[addr >> 7] = addr;
+	lcd->pos = addr;
+}
+
+// home and clear go to every controller
+static void lcd_home(struct lcd_t *lcd)
+{
+	int k;
+
+	lcd->stats.home++;
+	for (k = 0; k < LCD_CTRLS; k++)
+		lcd->ac[k] = k << 7;
+	lcd->pos = 0;
+}
+
+static void lcd_clear(struct lcd_t *lcd)
+{
+	int k;
+
+	lcd->stats.clear++;
+	memset(lcd->dram, ' ', sizeof(lcd->dram));
+	for (k = 0; k < LCD_CTRLS; k++)
+		lcd->ac[k] = k << 7;
+}
+
+static void lcd_cursor(struct lcd_t *lcd, bool enable)
+{
+	lcd->stats.ctrl++;
+	lcd->cursor = enable;
+}
+
+static void lcd_blink(struct lcd_t *lcd, bool enable)
+{
+	lcd->stats.ctrl++;
+	lcd->blink = enable;
+}
+
+static void lcd_inc_pos(struct lcd_t *lcd);
+
+// chars go to the controller the cursor is on
+static void lcd_putchar(struct lcd_t *lcd, char c)
+{
+	uint8_t *ac = &lcd->ac[lcd->pos >> 7];
+
+	lcd->stats.data++;
+	lcd->dram[*ac] = c;
+	*ac = lcd_ac_next(*ac);
+	lcd_inc_pos(lcd);
+}
+
+#include "fls_lcd_engine.c"
+
+#define LCD_HOST_GEOMETRIES (sizeof(lcd_geometries) / sizeof(lcd_geometries[0]))
+
+#define LCD_HOST_ROMS (sizeof(lcd_roms) / sizeof(lcd_roms[0]))
+
+static struct lcd_map lcd_host_maps[LCD_HOST_GEOMETRIES];
+static struct lcd_charset lcd_host_charsets[LCD_HOST_ROMS];
+
+int lcd_host_init(struct lcd_t *lcd, const char *geometry)
+{
+	const struct lcd_geometry *geo = lcd_geometry_find(geometry ? geometry : lcd_geometries[0].name);
+	struct lcd_map *map;
+
+	if (!geo)
+		return -1;
+	map = &lcd_host_maps[geo - lcd_geometries];
+	if (!map->geo)
+		lcd_map_build(map, geo);
+
+	memset(lcd, 0, sizeof(*lcd));
+	memset(lcd->dram, ' ', sizeof(lcd->dram));
+	lcd->wstate = WRITE_STATE_NORMAL;
+	lcd->am = true;
+	lcd->map = map;
+	return 0;
+}
+
+const char *lcd_host_geometry(int k)
+{
+	return k >= 0 && k < LCD_HOST_GEOMETRIES ? lcd_geometries[k].name : NULL;
+}
+
+int lcd_host_charset(struct lcd_t *lcd, const char *rom)
+{
+	const struct lcd_rom *r;
+	struct lcd_charset *cs;
+
+	if (!rom) {
+		lcd->charset = NULL;
+		return 0;
+	}
+	r = lcd_rom_find(rom);
+	if (!r)
+		return -1;
+	cs = &lcd_host_charsets[r - lcd_roms];
+	if (!cs->rom)
+		lcd_charset_build(cs, r);
+	lcd->charset = cs;
+	return 0;
+}
+
+ssize_t lcd_host_print(struct lcd_t *lcd, const char *buf, size_t count)
+{
+	return lcd_puts(lcd, buf, count);
+}
+
+int lcd_host_gotoxy(struct lcd_t *lcd, int x, int y, enum whence_t whence)
+{
+	return lcd_gotoxy(lcd, x, y, whence);
+}
+
+void lcd_host_line(struct lcd_t *lcd, int y, char *buf)
+{
+	memcpy(buf, &lcd->dram[lcd->map->geo->start[y]], lcd->map->cols);
+	buf[lcd->map->cols] = 0;
+}
+
+unsigned long lcd_host_cmds(struct lcd_t *lcd)
+{
+	struct lcd_host_stats *s = &lcd->stats;
+
+	return s->data + s->addr + s->home + s->clear + s->ctrl;
+}
+
+// NULL when the engine state is consistent, otherwise what is wrong with it
+const char *lcd_host_check(struct lcd_t *lcd)
+{
+	int p = lcd->pos;
+
+	if (lcd->wstate != WRITE_STATE_NORMAL && lcd->wstate != WRITE_STATE_ESCAPE1)
+		return "bad write state";
+	if (p < 0 || p >= LCD_ADDRS)
+		return "position outside dram";
+	if (p != lcd->ac[p >> 7])
+		return "position does not match the address counter";
+	if (lcd->map->y[p] >= 0)
+		return NULL;	// visible
+	if (!lcd->am && lcd->map->unpark[p] != p)
+		return NULL;	// parked off the end of a line
+	return "position off screen";
+}
@@ -0,0 +1,56 @@
+/*
+ * FLS front panel lcd print engine, host build
+ *
+ * Builds fls_lcd_engine.c as a userspace library on top of a mock bus that
+ * keeps the dram and the lcd's address counter, and counts the commands the
+ * engine issues. Used by the fuzzer (lcd_fuzz.c) and the replay benchmark
+ * (lcd_replay.c).
+ */
+#ifndef LCD_HOST_H
+#define LCD_HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "fls_lcd_engine.h"
+
+struct lcd_host_stats {
+	unsigned long data;	// chars written
+	unsigned long addr;	// set dram address commands
+	unsigned long home;
+	unsigned long clear;
+	unsigned long ctrl;	// display control commands
+};
+
+struct lcd_t {
+	// engine state, as in the driver
+	int pos;
+	enum write_state wstate;
+	struct lcd_charset *charset;	// NULL to put text as it comes
+	struct lcd_utf8 utf8;
+	bool am;
+	bool cursor;
+	bool blink;
+	const struct lcd_map *map;
+
+	// mock bus
+	uint8_t ac[LCD_CTRLS];	// each controller's address counter
+	char dram[LCD_ADDRS];
+	struct lcd_host_stats stats;
+};
+
+// print unknown escape warnings etc to stderr
+extern int lcd_host_verbose;
+
+// geometry is one of the engine's ("16x4", "20x4" etc), NULL for the default
+int lcd_host_init(struct lcd_t *lcd, const char *geometry);
+const char *lcd_host_geometry(int k);	// the k'th geometry's name, NULL past the last
+// decode utf-8 to rom ("a00", "a02") codes as the driver does, NULL to stop
+int lcd_host_charset(struct lcd_t *lcd, const char *rom);
+ssize_t lcd_host_print(struct lcd_t *lcd, const char *buf, size_t count);
+int lcd_host_gotoxy(struct lcd_t *lcd, int x, int y, enum whence_t whence);
+void lcd_host_line(struct lcd_t *lcd, int y, char *buf);	// buf holds LCD_MAX_COLS + 1
+unsigned long lcd_host_cmds(struct lcd_t *lcd);
+const char *lcd_host_check(struct lcd_t *lcd);
+
+#endif
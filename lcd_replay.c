@@ -0,0 +1,128 @@
+/*
+ * FLS front panel lcd print engine replay benchmark
+ *
+ * Replays captured write streams through the engine on the mock bus and
+ * reports the engine's cost per char and the commands it would have put on
+ * the bus. A capture is just the bytes an application wrote, eg run it
+ * against a file instead of the device:
+ *
+ *   lcd_unit_test -d capture.bin -n 1000
+ *   lcd_replay -n 100 capture.bin
+ *
+ * -g picks the panel geometry (16x4 by default), -r the rom utf-8 is decoded
+ * for (a00 by default, as the driver does) or none to put bytes as they are.
+ *
+ * lcd_unit_test writes its seeks into a capture as the escapes that move the
+ * cursor to the same cell, so a capture replays what the device saw. NULs end
+ * a write in the driver, so they split the stream into writes here.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "lcd_host.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *load(const char *path, size_t *len)
+{
+	char *buf = NULL;
+	size_t n = 0, size = 0;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+	do {
+		size = size ? 2 * size : 4096;
+		buf = realloc(buf, size);
+		if (!buf)
+			break;
+		n += fread(buf + n, 1, size - n, f);
+	} while (n == size);
+	fclose(f);
+
+	*len = n;
+	return buf;
+}
+
+static void replay(struct lcd_t *lcd, const char *buf, size_t len)
+{
+	size_t l = 0;
+
+	while (l < len) {
+		l += lcd_host_print(lcd, buf + l, len - l);
+		// skip the nul that ended the write
+		if (l < len && buf[l] == 0)
+			l++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct lcd_t lcd;
+	unsigned long cmds, addrs;
+	double t0, secs;
+	size_t len;
+	char *buf;
+	const char *geometry = NULL;
+	const char *rom = "a00";
+	int loops = 100;
+	int k, n, opt;
+
+	while ((opt = getopt(argc, argv, "g:n:r:v")) != -1) {
+		switch (opt) {
+			case 'g': geometry = optarg; break;
+			case 'n': loops = atoi(optarg); break;
+			case 'r': rom = strcmp(optarg, "none") ? optarg : NULL; break;
+			case 'v': lcd_host_verbose = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-g geometry] [-n loops] [-r rom|none] [-v] capture...\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc || loops <= 0 || lcd_host_init(&lcd, geometry) || lcd_host_charset(&lcd, rom)) {
+		fprintf(stderr, "usage: %s [-g geometry] [-n loops] [-r rom|none] [-v] capture...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%-24s %10s %10s %10s %9s %9s\n", "capture", "bytes", "ns/byte", "Mbyte/s", "cmd/byte", "addr/byte");
+	for (k = optind; k < argc; k++) {
+		buf = load(argv[k], &len);
+		if (!buf)
+			return EXIT_FAILURE;
+		if (!len) {
+			free(buf);
+			continue;
+		}
+
+		// one untimed pass to count the bus commands, then the timed ones
+		lcd_host_init(&lcd, geometry);
+		lcd_host_charset(&lcd, rom);
+		replay(&lcd, buf, len);
+		cmds = lcd_host_cmds(&lcd);
+		addrs = lcd.stats.addr;
+
+		t0 = now();
+		for (n = 0; n < loops; n++)
+			replay(&lcd, buf, len);
+		secs = now() - t0;
+
+		printf("%-24s %10zu %10.2f %10.2f %9.2f %9.2f\n", argv[k], len,
+			secs * 1e9 / ((double)len * loops),
+			(double)len * loops / secs / 1e6,
+			(double)cmds / len, (double)addrs / len);
+		free(buf);
+	}
+
+	return 0;
+}
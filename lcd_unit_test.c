@@ -1,7 +1,30 @@
+/*
+ * FLS front panel lcd benchmark
+ *
+ * Runs fixed workloads against /dev/lcd (the real lcd, or the driver loaded
+ * with sim=1 for the simulated one) and reports chars/s, write() latency
+ * percentiles and cpu time. With -c pointing at the driver's sim sysfs
+ * attribute the bus cycles and commands per char are reported too. -s runs
+ * the old visual smoke test instead.
+ *
+ * With -d naming a plain file the writes are captured there for lcd_replay
+ * instead, seeks and all: a file can't move the lcd's cursor, so each seek
+ * is written as the escapes that move it to the same cell.
+ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <fcntl.h>
-#define log(msg, ...) fprintf(stdout, __FILE__ ":%s():[%d]:" msg, __func__, __LINE__, __VA_ARGS__)
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#define log(msg, ...) fprintf(stderr, __FILE__ ":%s():[%d]:" msg, __func__, __LINE__, ##__VA_ARGS__)
+
+#define LINE_LENGTH (16)
+#define LINES       (4)
+#define MAX_OP      (256)
 
 FILE *lcd;
 
@@ -10,7 +33,7 @@ void test(void)
 	int k;
 
 	// a lot of hello's
-	log("hello world test\n", 1);
+	log("hello world test\n");
 	rewind(lcd);
 	fprintf(lcd, "\eJ\eH"); // escape seq to clear screen and goto home
 	fprintf(lcd, "hello world\n\r");
@@ -23,14 +46,14 @@ void test(void)
 	fflush(lcd);
 
 	// random number test
-	log("random number test\n", 1);
+	log("random number test\n");
 	srand(time(NULL));
 	fseek(lcd, 0x11, SEEK_SET);
 	fprintf(lcd, "random test:\n\r");
 	for (k = 0; k < 10; k++)
 	{
 		fseek(lcd, 0x20, SEEK_SET);
-		fprintf(lcd, "\t%1.4f\t%1.2f\n\r", 
+		fprintf(lcd, "\t%1.4f\t%1.2f\n\r",
 			(float)rand()/(float)RAND_MAX,
 			(float)rand()/(float)RAND_MAX);
 		fflush(lcd);
@@ -38,7 +61,7 @@ void test(void)
 	}
 
 	// long test
-	log("long test\n", 1);
+	log("long test\n");
 	rewind(lcd);
 	fprintf(lcd, "%1.48f", (float)rand()/(float)RAND_MAX);
 	fflush(lcd);
@@ -52,15 +75,327 @@ void test(void)
 	}
 }
 
+// a workload builds the bytes for its n'th operation (one write) and says
+// where to seek first (or -1 to write at the current position)
+struct workload {
+	const char *name;
+	int (*op)(int n, char *buf, off_t *seek);
+};
+
+// every cell of the screen, with content that changes each time
+static int op_redraw(int n, char *buf, off_t *seek)
+{
+	int k, l = 0;
+
+	l += sprintf(buf, "\eH");
+	for (k = 0; k < LINES * LINE_LENGTH; k++)
+		buf[l++] = 'A' + (n + k) % 26;
+	*seek = -1;
+	return l;
+}
+
+// a "label: value" field, only the value changes
+static int op_field(int n, char *buf, off_t *seek)
+{
+	*seek = 2 * LINE_LENGTH + 10;
+	return sprintf(buf, "%6d", n * 37 % 1000000);
+}
+
+// a marquee scrolling along the bottom line
+static int op_scroll(int n, char *buf, off_t *seek)
+{
+	static const char text[] = "the quick brown fox jumps over the lazy dog ";
+	int k;
+
+	for (k = 0; k < LINE_LENGTH; k++)
+		buf[k] = text[(n + k) % (sizeof(text) - 1)];
+	*seek = 3 * LINE_LENGTH;
+	return LINE_LENGTH;
+}
+
+// cursor attributes and moves with the odd char in between
+static int op_escape(int n, char *buf, off_t *seek)
+{
+	*seek = -1;
+	return sprintf(buf, "\ev\eC\eb\eB\ea\eD\eh\eA%c\eV\eD", 'a' + n % 26);
+}
+
+// tabbed columns patched up with backspaces
+static int op_tabs(int n, char *buf, off_t *seek)
+{
+	*seek = LINE_LENGTH;
+	return sprintf(buf, "%d\t%d\t%d\b\b\b*\r\t\b-", n % 10, (n / 10) % 10, (n / 100) % 10);
+}
+
+static const struct workload workloads[] = {
+	{"redraw", op_redraw},
+	{"field", op_field},
+	{"scroll", op_scroll},
+	{"escape", op_escape},
+	{"tabs", op_tabs},
+};
+
+struct sim_counters {
+	unsigned long nibbles, cmds, data_writes;
+};
+
+struct result {
+	const char *name;
+	int ops;
+	long bytes;
+	double secs;
+	double p50, p90, p99, max;	// us per op
+	double user, sys;		// cpu secs
+	int have_sim;
+	struct sim_counters sim;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+	return d < 0 ? -1 : d > 0;
+}
+
+// reset (by writing) or read the driver's simulated lcd counters
+static int sim_counters(const char *path, struct sim_counters *c)
+{
+	unsigned long sets, gets;
+	FILE *f;
+	int n;
+
+	if (!c) {
+		f = fopen(path, "w");
+		if (!f)
+			return -1;
+		fprintf(f, "0\n");
+		return fclose(f);
+	}
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	n = fscanf(f, "sets %lu gets %lu nibbles %lu cmds %lu data_writes %lu",
+		&sets, &gets, &c->nibbles, &c->cmds, &c->data_writes);
+	fclose(f);
+	return n == 5 ? 0 : -1;
+}
+
+// the escapes that take the cursor to the cell a seek to off would (home,
+// down the lines then across), returns their length
+static int seek_escapes(char *buf, off_t off)
+{
+	int k, l = sprintf(buf, "\eH");
+
+	for (k = 0; k < off / LINE_LENGTH; k++)
+		l += sprintf(buf + l, "\eB");
+	for (k = 0; k < off % LINE_LENGTH; k++)
+		l += sprintf(buf + l, "\eC");
+	return l;
+}
+
+static int run(int fd, int capture, const struct workload *w, int ops, const char *sim, struct result *r)
+{
+	struct rusage ru0, ru1;
+	double *lat, t0, t;
+	char buf[MAX_OP], move[MAX_OP];
+	off_t seek;
+	int k, l, m;
+
+	lat = calloc(ops, sizeof(*lat));
+	if (!lat)
+		return -1;
+
+	memset(r, 0, sizeof(*r));
+	r->name = w->name;
+	r->ops = ops;
+	if (sim && sim_counters(sim, NULL) < 0)
+		log("unable to reset %s\n", sim);
+
+	getrusage(RUSAGE_SELF, &ru0);
+	t0 = now();
+	for (k = 0; k < ops; k++) {
+		l = w->op(k, buf, &seek);
+		t = now();
+		if (seek >= 0 && capture) {
+			m = seek_escapes(move, seek);
+			if (write(fd, move, m) != m) {
+				log("write failed on %s op %d\n", w->name, k);
+				free(lat);
+				return -1;
+			}
+			r->bytes += m;
+		} else if (seek >= 0 && lseek(fd, seek, SEEK_SET) < 0) {
+			log("seek failed on %s op %d\n", w->name, k);
+			free(lat);
+			return -1;
+		}
+		if (write(fd, buf, l) != l) {
+			log("write failed on %s op %d\n", w->name, k);
+			free(lat);
+			return -1;
+		}
+		lat[k] = (now() - t) * 1e6;
+		r->bytes += l;
+	}
+	r->secs = now() - t0;
+	getrusage(RUSAGE_SELF, &ru1);
+
+	r->user = cpu_secs(&ru1.ru_utime) - cpu_secs(&ru0.ru_utime);
+	r->sys = cpu_secs(&ru1.ru_stime) - cpu_secs(&ru0.ru_stime);
+	r->have_sim = sim && sim_counters(sim, &r->sim) == 0;
+
+	qsort(lat, ops, sizeof(*lat), cmp_double);
+	r->p50 = lat[ops * 50 / 100];
+	r->p90 = lat[ops * 90 / 100];
+	r->p99 = lat[ops * 99 / 100];
+	r->max = lat[ops - 1];
+	free(lat);
+
+	return 0;
+}
+
+enum format {FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON};
+
+static void report(const struct result *r, enum format fmt, int first)
+{
+	double cps = r->bytes / r->secs;
+
+	switch (fmt) {
+		case FORMAT_TEXT:
+			if (first)
+				printf("%-8s %6s %8s %10s %9s %9s %9s %9s %8s %8s %9s %9s\n",
+					"workload", "ops", "bytes", "chars/s", "p50 us", "p90 us", "p99 us",
+					"max us", "user s", "sys s", "cmd/char", "nib/char");
+			printf("%-8s %6d %8ld %10.1f %9.1f %9.1f %9.1f %9.1f %8.3f %8.3f",
+				r->name, r->ops, r->bytes, cps, r->p50, r->p90, r->p99, r->max, r->user, r->sys);
+			if (r->have_sim)
+				printf(" %9.2f %9.2f", (double)r->sim.cmds / r->bytes, (double)r->sim.nibbles / r->bytes);
+			printf("\n");
+			break;
+
+		case FORMAT_CSV:
+			if (first)
+				printf("workload,ops,bytes,secs,chars_per_s,p50_us,p90_us,p99_us,max_us,user_s,sys_s,nibbles,cmds,data_writes\n");
+			printf("%s,%d,%ld,%.6f,%.1f,%.1f,%.1f,%.1f,%.1f,%.6f,%.6f",
+				r->name, r->ops, r->bytes, r->secs, cps, r->p50, r->p90, r->p99, r->max, r->user, r->sys);
+			if (r->have_sim)
+				printf(",%lu,%lu,%lu\n", r->sim.nibbles, r->sim.cmds, r->sim.data_writes);
+			else
+				printf(",,,\n");
+			break;
+
+		case FORMAT_JSON:
+			// one object per line so results can be appended and grepped
+			printf("{\"workload\": \"%s\", \"ops\": %d, \"bytes\": %ld, \"secs\": %.6f, \"chars_per_s\": %.1f, "
+				"\"latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+				"\"cpu_s\": {\"user\": %.6f, \"sys\": %.6f}",
+				r->name, r->ops, r->bytes, r->secs, cps, r->p50, r->p90, r->p99, r->max, r->user, r->sys);
+			if (r->have_sim)
+				printf(", \"sim\": {\"nibbles\": %lu, \"cmds\": %lu, \"data_writes\": %lu}",
+					r->sim.nibbles, r->sim.cmds, r->sim.data_writes);
+			printf("}\n");
+			break;
+	}
+}
+
+static void usage(const char *prog)
+{
+	int k;
+
+	fprintf(stderr, "usage: %s [-d dev] [-n ops] [-w workload] [-o text|csv|json] [-c sim_attr] [-s]\n", prog);
+	fprintf(stderr, "  -d dev       lcd device (default /dev/lcd)\n");
+	fprintf(stderr, "  -n ops       writes per workload (default 200)\n");
+	fprintf(stderr, "  -w workload  only run this workload:");
+	for (k = 0; k < sizeof(workloads) / sizeof(workloads[0]); k++)
+		fprintf(stderr, " %s", workloads[k].name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -o format    output format (default text)\n");
+	fprintf(stderr, "  -c sim_attr  sim sysfs attribute to read bus counters from (eg /sys/class/lcd/lcd/sim)\n");
+	fprintf(stderr, "  -s           run the visual smoke test instead\n");
+	exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv)
 {
-	lcd = fopen("/dev/lcd", "r+");
-	if (lcd == NULL)
+	const char *dev = "/dev/lcd";
+	const char *only = NULL;
+	const char *sim = NULL;
+	enum format fmt = FORMAT_TEXT;
+	struct result r;
+	struct stat st;
+	int ops = 200;
+	int capture;
+	int smoke = 0;
+	int first = 1;
+	int fd, k, opt;
+
+	while ((opt = getopt(argc, argv, "d:n:w:o:c:s")) != -1) {
+		switch (opt) {
+			case 'd': dev = optarg; break;
+			case 'n': ops = atoi(optarg); break;
+			case 'w': only = optarg; break;
+			case 'c': sim = optarg; break;
+			case 's': smoke = 1; break;
+			case 'o':
+				if (!strcmp(optarg, "csv"))
+					fmt = FORMAT_CSV;
+				else if (!strcmp(optarg, "json"))
+					fmt = FORMAT_JSON;
+				else if (!strcmp(optarg, "text"))
+					fmt = FORMAT_TEXT;
+				else
+					usage(argv[0]);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (ops <= 0)
+		usage(argv[0]);
+
+	if (smoke) {
+		lcd = fopen(dev, "r+");
+		if (lcd == NULL)
+			exit(EXIT_FAILURE);
+		test();
+		fclose(lcd);
+		return 0;
+	}
+
+	// creating a plain file instead of the device captures the stream for lcd_replay
+	fd = open(dev, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log("unable to open %s\n", dev);
 		exit(EXIT_FAILURE);
+	}
+	capture = !S_ISCHR(st.st_mode);
+
+	// start from a blank screen so every run sees the same lcd
+	if (write(fd, "\eJ\eH", 4) != 4)
+		log("unable to clear %s\n", dev);
 
-	test();
+	for (k = 0; k < sizeof(workloads) / sizeof(workloads[0]); k++) {
+		if (only && strcmp(only, workloads[k].name))
+			continue;
+		if (run(fd, capture, &workloads[k], ops, sim, &r) < 0)
+			exit(EXIT_FAILURE);
+		report(&r, fmt, first);
+		first = 0;
+	}
 
-	fclose(lcd);
+	close(fd);
 	return 0;
 }
-